@@ -9,19 +9,11 @@
 #include  <Protocol/DiskIo2.h>
 #include  <Protocol/BlockIo.h>
 #include  <Guid/FileInfo.h>
+#include  <Guid/Acpi.h>
 #include  "frame_buffer_config.hpp"
+#include  "memory_map.hpp"
 #include  "elf.hpp"
 
-// #@@range_begin(struct_memory_map)
-struct MemoryMap {
-  UINTN buffer_size; 
-  VOID* buffer;
-  UINTN map_size;
-  UINTN map_key;
-  UINTN descriptor_size;
-  UINT32 descriptor_version;
-};
-// #@@range_end(struct_memory_map)
 
 // #@@range_begin(get_memory_map)
 EFI_STATUS GetMemoryMap(struct MemoryMap* map) {
@@ -363,10 +355,22 @@ EFI_STATUS EFIAPI UefiMain(
       Halt();
   }
 
+  //the kernel finds the ACPI tables (e.g. MCFG for PCIe) from RSDP. NULL if the firmware has none.
+  VOID* acpi_table = NULL;
+  for (UINTN i = 0; i < system_table->NumberOfTableEntries; ++i) {
+    if (CompareGuid(&gEfiAcpiTableGuid,
+                    &system_table->ConfigurationTable[i].VendorGuid)) {
+      acpi_table = system_table->ConfigurationTable[i].VendorTable;
+      break;
+    }
+  }
+
   //const is used to declare argument is constant, which means it won't be changed.
-  typedef void EntryPointType(const struct FrameBufferConfig*); //we have to call entry point as C language
+  //the kernel takes the free memory (EfiConventionalMemory) from memmap.
+  typedef void EntryPointType(const struct FrameBufferConfig*, VOID*,
+                              const struct MemoryMap*); //we have to call entry point as C language
   EntryPointType* entry_point = (EntryPointType*)entry_addr; //entry_addr is address of entry point
-  entry_point(&config); //entry_point is an address of a function whose pointer type is defined ad EntryPointType
+  entry_point(&config, acpi_table, &memmap); //entry_point is an address of a function whose pointer type is defined ad EntryPointType
   //while(1) is icluded in entry_point(),so "ALl done " sohldn't printed.
   
   Print(L"All done\n");
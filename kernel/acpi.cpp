@@ -0,0 +1,73 @@
+#include "acpi.hpp"
+
+#include <cstring>
+
+namespace {
+    //the sum of all bytes of a table is 0 when it is valid.
+    uint8_t SumBytes(const void* data, size_t bytes) {
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+        uint8_t sum = 0;
+        for (size_t i = 0; i < bytes; ++i) {
+            sum += p[i];
+        }
+        return sum;
+    }
+}
+
+namespace acpi {
+    bool RSDP::IsValid() const {
+        if (strncmp(signature, "RSD PTR ", 8) != 0) {
+            return false;
+        }
+        if (revision != 2) { //XSDT exists only in ACPI 2.0 and later
+            return false;
+        }
+        return SumBytes(this, 20) == 0 && SumBytes(this, 36) == 0;
+    }
+
+    bool DescriptionHeader::IsValid(const char* expected_signature) const {
+        if (strncmp(signature, expected_signature, 4) != 0) {
+            return false;
+        }
+        return SumBytes(this, length) == 0;
+    }
+
+    const DescriptionHeader& XSDT::operator[](size_t i) const {
+        //the entries are 64 bit but not aligned to 8 bytes, so read them with memcpy.
+        uint64_t addr;
+        memcpy(&addr, reinterpret_cast<const char*>(&header) + sizeof(DescriptionHeader)
+                      + sizeof(uint64_t) * i, sizeof(addr));
+        return *reinterpret_cast<const DescriptionHeader*>(addr);
+    }
+
+    size_t XSDT::Count() const {
+        return (header.length - sizeof(DescriptionHeader)) / sizeof(uint64_t);
+    }
+
+    const MCFGEntry& MCFG::operator[](size_t i) const {
+        return reinterpret_cast<const MCFGEntry*>(this + 1)[i];
+    }
+
+    size_t MCFG::Count() const {
+        return (header.length - sizeof(MCFG)) / sizeof(MCFGEntry);
+    }
+
+    Error Initialize(const RSDP* rsdp) {
+        if (rsdp == nullptr || !rsdp->IsValid()) {
+            return MAKE_ERROR(Error::kInvalidDescriptor);
+        }
+
+        const XSDT& xsdt = *reinterpret_cast<const XSDT*>(rsdp->xsdt_address);
+        if (!xsdt.header.IsValid("XSDT")) {
+            return MAKE_ERROR(Error::kInvalidDescriptor);
+        }
+
+        for (size_t i = 0; i < xsdt.Count(); ++i) {
+            const auto& entry = xsdt[i];
+            if (entry.IsValid("MCFG")) {
+                mcfg = reinterpret_cast<const MCFG*>(&entry);
+            }
+        }
+        return MAKE_ERROR(Error::kSuccess);
+    }
+}
@@ -0,0 +1,82 @@
+/**
+ * @file acpi.hpp
+ *
+ * ACPI テーブル定義や操作用プログラムを集めたファイル．
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "error.hpp"
+
+namespace acpi {
+  /** @brief RSDP（Root System Description Pointer）
+   *
+   * UEFI のコンフィギュレーションテーブルからブートローダが取り出して渡す．
+   */
+  struct RSDP {
+    char signature[8];
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_address;
+    uint32_t length;
+    uint64_t xsdt_address;
+    uint8_t extended_checksum;
+    char reserved[3];
+
+    bool IsValid() const;
+  } __attribute__((packed));
+
+  /** @brief すべての記述テーブルに共通のヘッダ */
+  struct DescriptionHeader {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+
+    bool IsValid(const char* expected_signature) const;
+  } __attribute__((packed));
+
+  /** @brief XSDT（各記述テーブルへの 64 ビットポインタの配列） */
+  struct XSDT {
+    DescriptionHeader header;
+
+    const DescriptionHeader& operator[](size_t i) const;
+    size_t Count() const;
+  } __attribute__((packed));
+
+  /** @brief MCFG の 1 エントリ．PCI セグメント 1 つ分の ECAM 領域を表す． */
+  struct MCFGEntry {
+    uint64_t base_address;
+    uint16_t segment_group;
+    uint8_t start_bus;
+    uint8_t end_bus;
+    uint32_t reserved;
+  } __attribute__((packed));
+
+  /** @brief MCFG（PCI Express のメモリマップドコンフィギュレーション空間） */
+  struct MCFG {
+    DescriptionHeader header;
+    uint64_t reserved;
+
+    const MCFGEntry& operator[](size_t i) const;
+    size_t Count() const;
+  } __attribute__((packed));
+
+  /** @brief Initialize() が見つけた MCFG．存在しなければ nullptr． */
+  inline const MCFG* mcfg;
+
+  /** @brief RSDP を検証し，必要な記述テーブルを探す．
+   *
+   * rsdp が nullptr か不正な場合はエラーを返し，テーブルは何も設定されない．
+   */
+  Error Initialize(const RSDP* rsdp);
+}
@@ -17,4 +17,17 @@ global IoIn32  ; uint32_t IoIn32(uint16_t addr);
 IoIn32:
     mov dx, di    ; dx = addr
     in eax, dx ;import the value from dx address to the register named eax  
-    ret
\ No newline at end of file
+    ret
+
+global IoOut8  ; void IoOut8(uint16_t addr, uint8_t data);
+IoOut8:
+    mov dx, di    ; dx = addr
+    mov al, sil   ; al = data
+    out dx, al
+    ret
+
+global IoIn8  ; uint8_t IoIn8(uint16_t addr);
+IoIn8:
+    mov dx, di    ; dx = addr
+    in al, dx
+    ret
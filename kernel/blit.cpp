@@ -0,0 +1,286 @@
+#include "blit.hpp"
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+namespace {
+  //regions at least this large are written with non-temporal stores
+  //so that they don't evict everything else from the cache.
+  const size_t kNonTemporalThreshold = 4096; //bytes
+
+  bool UseNonTemporal(size_t count) {
+    return count * sizeof(uint32_t) >= kNonTemporalThreshold;
+  }
+
+  uint32_t SwapRB(uint32_t v) {
+    return (v & 0xff00ff00u) | ((v & 0xffu) << 16) | ((v >> 16) & 0xffu);
+  }
+
+  bool IsAligned(const void* p, uintptr_t alignment) {
+    return (reinterpret_cast<uintptr_t>(p) & (alignment - 1)) == 0;
+  }
+
+  void FillScalar(uint32_t* dst, uint32_t value, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+      dst[i] = value;
+    }
+  }
+
+  void CopyScalar(uint32_t* dst, const uint32_t* src, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+      dst[i] = src[i];
+    }
+  }
+
+  void CopyMaskedScalar(uint32_t* dst, const uint32_t* src, const uint32_t* mask,
+                        size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+      dst[i] = (src[i] & mask[i]) | (dst[i] & ~mask[i]);
+    }
+  }
+
+  void CopySwapRBScalar(uint32_t* dst, const uint32_t* src, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+      dst[i] = SwapRB(src[i]);
+    }
+  }
+
+  //SSE2 is always available on x86-64, but we keep the scalar path for
+  //the period before InitializeBlit() is called.
+  void FillSSE2(uint32_t* dst, uint32_t value, size_t count) {
+    for (; count > 0 && !IsAligned(dst, 16); --count) {
+      *dst++ = value;
+    }
+
+    const __m128i v = _mm_set1_epi32(value);
+    if (UseNonTemporal(count)) {
+      for (; count >= 4; count -= 4, dst += 4) {
+        _mm_stream_si128(reinterpret_cast<__m128i*>(dst), v);
+      }
+      _mm_sfence();
+    } else {
+      for (; count >= 4; count -= 4, dst += 4) {
+        _mm_store_si128(reinterpret_cast<__m128i*>(dst), v);
+      }
+    }
+    FillScalar(dst, value, count);
+  }
+
+  void CopySSE2(uint32_t* dst, const uint32_t* src, size_t count) {
+    for (; count > 0 && !IsAligned(dst, 16); --count) {
+      *dst++ = *src++;
+    }
+
+    if (UseNonTemporal(count)) {
+      for (; count >= 4; count -= 4, dst += 4, src += 4) {
+        auto x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+        _mm_stream_si128(reinterpret_cast<__m128i*>(dst), x);
+      }
+      _mm_sfence();
+    } else {
+      for (; count >= 4; count -= 4, dst += 4, src += 4) {
+        auto x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+        _mm_store_si128(reinterpret_cast<__m128i*>(dst), x);
+      }
+    }
+    CopyScalar(dst, src, count);
+  }
+
+  //sprites are small, so neither alignment nor non-temporal stores pay off.
+  void CopyMaskedSSE2(uint32_t* dst, const uint32_t* src, const uint32_t* mask,
+                      size_t count) {
+    for (; count >= 4; count -= 4, dst += 4, src += 4, mask += 4) {
+      auto s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+      auto m = _mm_loadu_si128(reinterpret_cast<const __m128i*>(mask));
+      auto d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dst),
+                       _mm_or_si128(_mm_and_si128(s, m), _mm_andnot_si128(m, d)));
+    }
+    CopyMaskedScalar(dst, src, mask, count);
+  }
+
+  void CopySwapRBSSE2(uint32_t* dst, const uint32_t* src, size_t count) {
+    const __m128i ag_mask = _mm_set1_epi32(0xff00ff00u);
+    const __m128i rb_mask = _mm_set1_epi32(0x00ff00ffu);
+    for (; count >= 4; count -= 4, dst += 4, src += 4) {
+      auto x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+      auto rb = _mm_and_si128(x, rb_mask);
+      auto y = _mm_or_si128(_mm_and_si128(x, ag_mask),
+                            _mm_or_si128(_mm_slli_epi32(rb, 16),
+                                         _mm_srli_epi32(rb, 16)));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), y);
+    }
+    CopySwapRBScalar(dst, src, count);
+  }
+
+  __attribute__((target("avx2")))
+  void FillAVX2(uint32_t* dst, uint32_t value, size_t count) {
+    for (; count > 0 && !IsAligned(dst, 32); --count) {
+      *dst++ = value;
+    }
+
+    const __m256i v = _mm256_set1_epi32(value);
+    if (UseNonTemporal(count)) {
+      for (; count >= 8; count -= 8, dst += 8) {
+        _mm256_stream_si256(reinterpret_cast<__m256i*>(dst), v);
+      }
+      _mm_sfence();
+    } else {
+      for (; count >= 8; count -= 8, dst += 8) {
+        _mm256_store_si256(reinterpret_cast<__m256i*>(dst), v);
+      }
+    }
+    FillScalar(dst, value, count);
+  }
+
+  __attribute__((target("avx2")))
+  void CopyAVX2(uint32_t* dst, const uint32_t* src, size_t count) {
+    for (; count > 0 && !IsAligned(dst, 32); --count) {
+      *dst++ = *src++;
+    }
+
+    if (UseNonTemporal(count)) {
+      for (; count >= 8; count -= 8, dst += 8, src += 8) {
+        auto x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+        _mm256_stream_si256(reinterpret_cast<__m256i*>(dst), x);
+      }
+      _mm_sfence();
+    } else {
+      for (; count >= 8; count -= 8, dst += 8, src += 8) {
+        auto x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+        _mm256_store_si256(reinterpret_cast<__m256i*>(dst), x);
+      }
+    }
+    CopyScalar(dst, src, count);
+  }
+
+  __attribute__((target("avx2")))
+  void CopyMaskedAVX2(uint32_t* dst, const uint32_t* src, const uint32_t* mask,
+                      size_t count) {
+    for (; count >= 8; count -= 8, dst += 8, src += 8, mask += 8) {
+      auto s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+      auto m = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(mask));
+      auto d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst));
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst),
+                          _mm256_or_si256(_mm256_and_si256(s, m), _mm256_andnot_si256(m, d)));
+    }
+    CopyMaskedSSE2(dst, src, mask, count);
+  }
+
+  __attribute__((target("avx2")))
+  void CopySwapRBAVX2(uint32_t* dst, const uint32_t* src, size_t count) {
+    //swap byte 0 and byte 2 of every pixel at once
+    const __m256i shuffle = _mm256_setr_epi8(
+        2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+        2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    for (; count >= 8; count -= 8, dst += 8, src += 8) {
+      auto x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst),
+                          _mm256_shuffle_epi8(x, shuffle));
+    }
+    CopySwapRBScalar(dst, src, count);
+  }
+
+  struct BlitFunctions {
+    BlitImpl impl;
+    void (*fill)(uint32_t*, uint32_t, size_t);
+    void (*copy)(uint32_t*, const uint32_t*, size_t);
+    void (*copy_masked)(uint32_t*, const uint32_t*, const uint32_t*, size_t);
+    void (*copy_swap_rb)(uint32_t*, const uint32_t*, size_t);
+  };
+
+  const BlitFunctions kScalarFunctions{
+    kBlitScalar, FillScalar, CopyScalar, CopyMaskedScalar, CopySwapRBScalar
+  };
+  const BlitFunctions kSSE2Functions{
+    kBlitSSE2, FillSSE2, CopySSE2, CopyMaskedSSE2, CopySwapRBSSE2
+  };
+  const BlitFunctions kAVX2Functions{
+    kBlitAVX2, FillAVX2, CopyAVX2, CopyMaskedAVX2, CopySwapRBAVX2
+  };
+
+  const BlitFunctions* blit = &kScalarFunctions;
+
+  uint64_t ReadXCR0() {
+    uint32_t lo, hi;
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return (static_cast<uint64_t>(hi) << 32) | lo;
+  }
+
+  bool HasAVX2() {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+      return false;
+    }
+    const bool osxsave = ecx & bit_OSXSAVE;
+    const bool avx = ecx & bit_AVX;
+    if (!osxsave || !avx) {
+      return false;
+    }
+    //the firmware (or we) must have enabled the YMM state in XCR0,
+    //otherwise AVX instructions raise #UD.
+    if ((ReadXCR0() & 0x6u) != 0x6u) {
+      return false;
+    }
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+      return false;
+    }
+    return ebx & bit_AVX2;
+  }
+
+  bool HasSSE2() {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+      return false;
+    }
+    return edx & bit_SSE2;
+  }
+}
+
+void InitializeBlit() {
+  if (!SelectBlitImpl(kBlitAVX2) && !SelectBlitImpl(kBlitSSE2)) {
+    SelectBlitImpl(kBlitScalar);
+  }
+}
+
+bool SelectBlitImpl(BlitImpl impl) {
+  switch (impl) {
+    case kBlitScalar:
+      blit = &kScalarFunctions;
+      return true;
+    case kBlitSSE2:
+      if (HasSSE2()) {
+        blit = &kSSE2Functions;
+        return true;
+      }
+      return false;
+    case kBlitAVX2:
+      if (HasAVX2()) {
+        blit = &kAVX2Functions;
+        return true;
+      }
+      return false;
+  }
+  return false;
+}
+
+BlitImpl CurrentBlitImpl() {
+  return blit->impl;
+}
+
+void FillPixels(uint32_t* dst, uint32_t value, size_t count) {
+  blit->fill(dst, value, count);
+}
+
+void CopyPixels(uint32_t* dst, const uint32_t* src, size_t count) {
+  blit->copy(dst, src, count);
+}
+
+void CopyPixelsMasked(uint32_t* dst, const uint32_t* src, const uint32_t* mask,
+                      size_t count) {
+  blit->copy_masked(dst, src, mask, count);
+}
+
+void CopyPixelsSwapRB(uint32_t* dst, const uint32_t* src, size_t count) {
+  blit->copy_swap_rb(dst, src, count);
+}
@@ -0,0 +1,58 @@
+/**
+ * @file blit.hpp
+ *
+ * フレームバッファ向けのバルク転送（塗りつぶし，コピー，フォーマット変換）．
+ *
+ * 各関数は 1 ピクセル 32 ビットの領域を対象とする．
+ * InitializeBlit() で CPUID を調べ，AVX2 / SSE2 / スカラのうち
+ * 使える中で最速の実装を選択する．
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+enum BlitImpl {
+  kBlitScalar,
+  kBlitSSE2,
+  kBlitAVX2,
+};
+
+/** @brief CPU の機能を調べて使用する実装を選択する．
+ *
+ * 呼び出す前はスカラ実装が使われる．
+ */
+void InitializeBlit();
+
+/** @brief 使用する実装を指定する．
+ *
+ * 実装同士の比較やテストに用いる．CPU が対応していない実装は選択せずに false を返す．
+ */
+bool SelectBlitImpl(BlitImpl impl);
+
+/** @brief 現在選択されている実装を返す． */
+BlitImpl CurrentBlitImpl();
+
+/** @brief dst から count ピクセルを value で埋める． */
+void FillPixels(uint32_t* dst, uint32_t value, size_t count);
+
+/** @brief src から dst へ count ピクセルをコピーする．
+ *
+ * 先頭から順にコピーするので，領域が重なってもよいのは dst <= src の場合のみ．
+ */
+void CopyPixels(uint32_t* dst, const uint32_t* src, size_t count);
+
+/** @brief mask のビットが立っている部分だけ src から dst へ count ピクセルをコピーする．
+ *
+ * dst = (src & mask) | (dst & ~mask) をピクセルごとに計算する．
+ * mask は通常ピクセルごとに 0 か 0xffffffff とし，スプライトの透過に用いる．
+ */
+void CopyPixelsMasked(uint32_t* dst, const uint32_t* src, const uint32_t* mask,
+                      size_t count);
+
+/** @brief src から dst へ R と B を入れ替えながら count ピクセルをコピーする．
+ *
+ * RGB 形式と BGR 形式の相互変換に用いる．予約バイトはそのまま残す．
+ */
+void CopyPixelsSwapRB(uint32_t* dst, const uint32_t* src, size_t count);
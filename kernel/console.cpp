@@ -6,43 +6,152 @@
 Console::Console(PixelWriter& writer,
     const PixelColor& fg_color, const PixelColor& bg_color)
     : writer_{writer}, fg_color_{fg_color}, bg_color_{bg_color}, 
-    buffer_{}, cursor_row_{0}, cursor_column_{0} {}
+    buffer_{}, last_line_{0}, num_lines_{1},
+    cursor_row_{0}, cursor_column_{0}, scroll_back_{0},
+    screen_{}, dirty_{}, pending_scroll_{0} {
+    const Cell blank{0, writer_.Pack(fg_color_), writer_.Pack(bg_color_)};
+    for (auto& row : screen_) {
+        for (auto& cell : row) {
+            cell = blank;
+        }
+    }
+}
 
 void Console::PutString(const char* s){
+    if (scroll_back_ != 0) { //new output always shows the latest lines.
+        scroll_back_ = 0;
+        MarkAllDirty();
+    }
+
     while (*s){
         if (*s == '\n'){ //\n is new line character.
             Newline();
         }
+        else if (*s == '\r'){ //go back to the head of the line. following characters overwrite the cells.
+            cursor_column_ = 0;
+        }
         else if (cursor_column_ < kColumns - 1){
-            WriteAscii(writer_, 8 * cursor_column_, 16 * cursor_row_ , *s , fg_color_); //8*16 bit per character
-            buffer_[cursor_row_][cursor_column_] = *s;
+            Line(0)[cursor_column_] = *s;
+            MarkDirty(cursor_row_, cursor_column_);
             ++cursor_column_;
         }
         ++s;
     }
 }
 
+void Console::ScrollBack(int lines){
+    //lines above the top of the screen which are still in the ring buffer.
+    const int max_lines = num_lines_ - (cursor_row_ + 1);
+    if (lines > max_lines) {
+        lines = max_lines;
+    }
+    if (lines < 0) {
+        lines = 0;
+    }
+    if (lines == scroll_back_) {
+        return;
+    }
+    scroll_back_ = lines;
+    MarkAllDirty(); //drawn by the next Refresh(), while nothing is over the console
+}
+
+void Console::Refresh(){
+    if (pending_scroll_ > 0) {
+        //the lines on the screen are already rendered, so move their pixels up
+        //instead of rendering all characters again. then clear the new lines.
+        //if everything has scrolled out, the moved pixels would all be overwritten anyway.
+        const int n = pending_scroll_;
+        if (n < kRows) {
+            writer_.Move({0, 0}, {{0, 16 * n}, {8 * kColumns, 16 * (kRows - n)}});
+            FillRectangle(writer_, {0, 16 * (kRows - n)}, {8 * kColumns, 16 * n}, bg_color_);
+
+            memmove(screen_[0], screen_[n], sizeof(screen_[0]) * (kRows - n));
+            const Cell blank{0, writer_.Pack(fg_color_), writer_.Pack(bg_color_)};
+            for (int row = kRows - n; row < kRows; ++row) {
+                for (auto& cell : screen_[row]) {
+                    cell = blank;
+                }
+            }
+        }
+        pending_scroll_ = 0;
+    }
+
+    const uint32_t fg = writer_.Pack(fg_color_), bg = writer_.Pack(bg_color_);
+    for (int row = 0; row < kRows; ++row) {
+        for (int i = 0; i < (kColumns + 31) / 32; ++i) {
+            for (uint32_t bits = dirty_[row][i]; bits != 0; bits &= bits - 1) {
+                const int column = 32 * i + __builtin_ctz(bits);
+                const char c = CharAt(row, column);
+                Cell& cell = screen_[row][column];
+                if (cell.c == c && cell.fg == fg && cell.bg == bg) {
+                    continue;
+                }
+                DrawCell(row, column, c);
+                cell = Cell{c, fg, bg};
+            }
+            dirty_[row][i] = 0;
+        }
+    }
+}
+
+bool Console::HasPendingRedraw() const{
+    if (pending_scroll_ > 0) {
+        return true;
+    }
+    for (const auto& row : dirty_) {
+        for (auto bits : row) {
+            if (bits != 0) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
 void Console::Newline(){
     cursor_column_ = 0;
+    //advancing the head of the ring buffer is O(1). the oldest line is overwritten.
+    last_line_ = (last_line_ + 1) & (kScrollbackRows - 1);
+    memset(Line(0), 0, kColumns + 1);
+    if (num_lines_ < kScrollbackRows) {
+        ++num_lines_;
+    }
+
     if ( cursor_row_ < kRows - 1 ){
         ++cursor_row_;
     }
     else {
-        for (int y = 0 ; y < 16 * kRows; ++y) {
-            for (int x = 0; x < 8 * kColumns; ++x){
-                writer_.Write(x,y,bg_color_);
-
-            }
+        //the screen is scrolled at the next Refresh(). the dirty bits are kept
+        //in the coordinates after scrolling, so move them up now.
+        if (pending_scroll_ < kRows) {
+            ++pending_scroll_;
+            memmove(dirty_[0], dirty_[1], sizeof(dirty_[0]) * (kRows - 1));
+            memset(dirty_[kRows - 1], 0, sizeof(dirty_[0]));
         }
-
-        for (int row = 0; row < kRows - 1 ; ++row) {
-            memcpy(buffer_[row], buffer_[row+1], kColumns + 1); //copy buffer_[row+1] to buffer_[row]
-            WriteString(writer_, 0, 16 * row, buffer_[row], fg_color_);
+        if (pending_scroll_ == kRows) {
+            //no pixels survive the scroll, so every cell has to be compared.
+            MarkAllDirty();
         }
-        memset(buffer_[kRows - 1],0,kColumns + 1); //set buffer_[kRows - 1] to 0
     }
 }
 
+void Console::MarkAllDirty(){
+    for (int row = 0; row < kRows; ++row) {
+        for (int i = 0; i < (kColumns + 31) / 32; ++i) {
+            const int columns = kColumns - 32 * i; //columns covered by this word
+            dirty_[row][i] = columns >= 32 ? ~0u : (1u << columns) - 1;
+        }
+    }
+}
 
+char Console::CharAt(int row, int column){
+    const int age = cursor_row_ - row + scroll_back_;
+    if (age < 0 || num_lines_ <= age) {
+        return 0;
+    }
+    return Line(age)[column];
+}
 
-
+void Console::DrawCell(int row, int column, char c){
+    WriteAscii(writer_, 8 * column, 16 * row, c ? c : ' ', fg_color_, bg_color_); //8*16 bit per character
+}
@@ -1,22 +1,65 @@
 #pragma once
 
 #include "graphics.hpp"
+#include "logger.hpp"
 
-class Console {
+class Console : public LogSink {
     public:
         //this is an area of console columns.
         static const int kRows = 25, kColumns = 80; //common member variavle among all classes.
+        //number of lines kept in the ring buffer, including the lines on the screen.
+        static const int kScrollbackRows = 2048;
+        static_assert((kScrollbackRows & (kScrollbackRows - 1)) == 0,
+                      "kScrollbackRows must be a power of 2");
         
+        //the console area is supposed to be filled with bg_color already.
         Console(PixelWriter& writer,
             const PixelColor& fg_color, const PixelColor& bg_color);
-        //output the string to console
+        //output the string to console. it is drawn at the next Refresh().
         void PutString(const char* s);
+        //show the lines which are 'lines' lines older than the latest ones. 0 shows the latest lines.
+        //it is clamped to the number of lines kept in the ring buffer. it is drawn at the next Refresh().
+        void ScrollBack(int lines);
+        //how many lines the screen is scrolled back now.
+        int ScrollBackLines() const { return scroll_back_; }
+        //rasterise only the cells whose content has changed since the last call.
+        void Refresh();
+        //true if the next Refresh() may draw something.
+        bool HasPendingRedraw() const;
+
+        //the console is also an output of the log.
+        virtual void Write(const char* s) override { PutString(s); }
+        virtual void Flush() override { Refresh(); }
     
     private:
+        //what is drawn in a cell on the screen. fg and bg are packed colors.
+        struct Cell {
+            char c;
+            uint32_t fg, bg;
+        };
+
         void Newline(); 
+        //draw a cell with its background, so it doesn't need to be cleared first. 0 is drawn as a blank.
+        void DrawCell(int row, int column, char c);
+        //the character which should be shown in the cell at the current scroll back position.
+        char CharAt(int row, int column);
+        void MarkDirty(int row, int column) {
+            dirty_[row][column / 32] |= 1u << (column % 32);
+        }
+        void MarkAllDirty();
+        //the line which is 'age' lines older than the line with the cursor.
+        char* Line(int age) {
+            return buffer_[(last_line_ - age) & (kScrollbackRows - 1)];
+        }
     
         PixelWriter& writer_;
         const PixelColor fg_color_, bg_color_; //fg_color is a color for string,bg_color is back ground color
-        char buffer_[kRows][kColumns + 1]; //save the string which is displayed on console area
-        int cursor_row_, cursor_column_; 
-};
\ No newline at end of file
+        char buffer_[kScrollbackRows][kColumns + 1]; //ring buffer of lines. buffer_[last_line_] has the cursor
+        int last_line_, num_lines_; //num_lines_ is the number of valid lines in buffer_
+        int cursor_row_, cursor_column_; //cursor_row_ is the row on the screen
+        int scroll_back_; //how many lines the screen is scrolled back
+
+        Cell screen_[kRows][kColumns]; //the cells as they are drawn on the screen now
+        uint32_t dirty_[kRows][(kColumns + 31) / 32]; //1 bit per cell which may have changed
+        int pending_scroll_; //lines to scroll the screen by at the next Refresh()
+};
@@ -1,5 +1,7 @@
 #include "font.hpp"
 
+#include <cstring>
+
 extern const uint8_t _binary_hankaku_bin_start;
 extern const uint8_t _binary_hankaku_bin_end;
 extern const uint8_t _binary_hankaku_bin_size; //extern means that we refer variable in other object file 
@@ -12,22 +14,85 @@ const uint8_t* GetFont(char c){
     return &_binary_hankaku_bin_start + index;
 }
 
+namespace {
+  //8 packed pixels for every possible font byte, for one (fg, bg, pixel format).
+  //a glyph row is drawn by copying one entry of rows instead of testing 8 bits.
+  struct GlyphRowTable {
+    bool valid;
+    PixelFormat format;
+    uint32_t fg, bg;
+    uint32_t rows[256][8];
+  };
+
+  const int kNumGlyphRowTables = 4;
+  GlyphRowTable glyph_row_tables[kNumGlyphRowTables];
+  int next_glyph_row_table; //the table which is replaced next (round robin)
+
+  const GlyphRowTable& GetGlyphRowTable(PixelFormat format, uint32_t fg, uint32_t bg) {
+    for (const auto& table : glyph_row_tables) {
+      if (table.valid && table.format == format && table.fg == fg && table.bg == bg) {
+        return table;
+      }
+    }
+
+    auto& table = glyph_row_tables[next_glyph_row_table];
+    next_glyph_row_table = (next_glyph_row_table + 1) % kNumGlyphRowTables;
+    table.valid = true;
+    table.format = format;
+    table.fg = fg;
+    table.bg = bg;
+    for (int bits = 0; bits < 256; ++bits) {
+      for (int dx = 0; dx < 8; ++dx) {
+        table.rows[bits][dx] = ((bits << dx) & 0x80u) ? fg : bg;
+      }
+    }
+    return table;
+  }
+
+  template <typename Format>
+  void WriteAsciiImpl(PixelWriter& writer, int x, int y, const uint8_t* font,
+                      const PixelColor& color) {
+    const uint32_t value = Format::Pack(color);
+    for (int dy = 0; dy < 16; ++dy) {
+      uint32_t* row = writer.PixelAt32(x, y + dy);
+      for (int dx = 0; dx < 8; ++dx) {
+        if ((font[dy] << dx) & 0x80u) {
+          row[dx] = value;
+        }
+      }
+    }
+  }
+}
+
 void WriteAscii(PixelWriter& writer, int x, int y, char c, const PixelColor& color) {
   const uint8_t* font = GetFont(c);
   if(font == nullptr){
     return;
   }
+  VisitPixelFormat(writer.Format(), [&](auto format) {
+    WriteAsciiImpl<decltype(format)>(writer, x, y, font, color);
+  });
+  writer.MarkDirty({x, y}, {8, 16});
+}
+
+void WriteAscii(PixelWriter& writer, int x, int y, char c,
+                const PixelColor& fg_color, const PixelColor& bg_color) {
+  const uint8_t* font = GetFont(c);
+  if (font == nullptr) {
+    FillRectangle(writer, {x, y}, {8, 16}, bg_color);
+    return;
+  }
+
+  const auto& table = GetGlyphRowTable(writer.Format(),
+                                       writer.Pack(fg_color), writer.Pack(bg_color));
   for (int dy = 0; dy < 16; ++dy) {
-    for (int dx = 0; dx < 8; ++dx) {
-      if ((font[dy] << dx) & 0x80u) {
-        writer.Write(x + dx, y + dy, color);
-      }
-    }
+    memcpy(writer.PixelAt32(x, y + dy), table.rows[font[dy]], sizeof(table.rows[0]));
   }
+  writer.MarkDirty({x, y}, {8, 16});
 }
 
 void WriteString(PixelWriter& writer, int x, int y , const char* s, const PixelColor& color){
     for (int i = 0;s[i] != '\0' ; ++i){
         WriteAscii(writer, x + 8 * i, y, s[i], color);
     }
-  }
\ No newline at end of file
+  }
@@ -4,4 +4,7 @@
 #include "graphics.hpp"
 
 void WriteAscii(PixelWriter& writer, int x, int y , char c, const PixelColor& color);
-void WriteString(PixelWriter& writer, int x, int y, const char* s, const PixelColor& color);
\ No newline at end of file
+//draw the character with its background. the glyph rows come from a cache of pre-packed pixels.
+void WriteAscii(PixelWriter& writer, int x, int y, char c,
+                const PixelColor& fg_color, const PixelColor& bg_color);
+void WriteString(PixelWriter& writer, int x, int y, const char* s, const PixelColor& color);
@@ -1,37 +1,130 @@
 #include "graphics.hpp"
 
-void RGBResv8BitPerColorPixelWriter::Write(int x, int y ,const PixelColor& c){
-    auto p = PixelAt(x,y);
-    p[0] = c.r;
-    p[1] = c.g;
-    p[2] = c.b;
+#include "shadow_buffer.hpp"
+
+namespace {
+    template <typename Format>
+    void DrawRectangleImpl(PixelWriter& writer, const Vector2D<int>& pos,
+                           const Vector2D<int>& size, const PixelColor& c) {
+        const uint32_t value = Format::Pack(c);
+        writer.FillSpan(pos.x, pos.y, size.x, value);
+        writer.FillSpan(pos.x, pos.y + size.y - 1, size.x, value);
+
+        for (int dy = 1;dy < size.y - 1; ++dy){
+            *writer.PixelAt32(pos.x, pos.y + dy) = value;
+            *writer.PixelAt32(pos.x + size.x - 1, pos.y + dy) = value;
+        }
+    }
+}
+
+Rectangle<int> PixelWriter::ClipToScreen(const Vector2D<int>& pos,
+                                         const Vector2D<int>& size) const {
+    int x0 = pos.x < 0 ? 0 : pos.x;
+    int y0 = pos.y < 0 ? 0 : pos.y;
+    int x1 = pos.x + size.x > Width() ? Width() : pos.x + size.x;
+    int y1 = pos.y + size.y > Height() ? Height() : pos.y + size.y;
+    if (x0 >= x1 || y0 >= y1) {
+        return {{0, 0}, {0, 0}};
+    }
+    return {{x0, y0}, {x1 - x0, y1 - y0}};
+}
+
+void PixelWriter::FillRect(const Vector2D<int>& pos, const Vector2D<int>& size,
+                           const PixelColor& c) {
+    //clip the rectangle to the screen so that we never write out of the frame buffer.
+    const auto r = ClipToScreen(pos, size);
+    if (r.size.x == 0) {
+        return;
+    }
+
+    const uint32_t value = Pack(c);
+    for (int dy = 0; dy < r.size.y; ++dy) {
+        FillSpan(r.pos.x, r.pos.y + dy, r.size.x, value);
+    }
+    MarkDirty(r.pos, r.size);
+}
+
+void PixelWriter::ReadPixels(const Rectangle<int>& rect, uint32_t* buf, int pitch) {
+    const auto r = ClipToScreen(rect.pos, rect.size);
+    if (r.size.x == 0) {
+        return;
+    }
+
+    buf += pitch * (r.pos.y - rect.pos.y) + (r.pos.x - rect.pos.x);
+    for (int dy = 0; dy < r.size.y; ++dy) {
+        CopyPixels(buf + pitch * dy, PixelAt32(r.pos.x, r.pos.y + dy), r.size.x);
+    }
+}
+
+void PixelWriter::WritePixels(const Rectangle<int>& rect, const uint32_t* buf, int pitch) {
+    const auto r = ClipToScreen(rect.pos, rect.size);
+    if (r.size.x == 0) {
+        return;
+    }
+
+    buf += pitch * (r.pos.y - rect.pos.y) + (r.pos.x - rect.pos.x);
+    for (int dy = 0; dy < r.size.y; ++dy) {
+        CopyPixels(PixelAt32(r.pos.x, r.pos.y + dy), buf + pitch * dy, r.size.x);
+    }
+    MarkDirty(r.pos, r.size);
 }
 
-void BGRResv8BitPerColorPixelWriter::Write(int x, int y, const PixelColor& c){
-    auto p = PixelAt(x,y);
-    p[0] = c.b;
-    p[1] = c.g;
-    p[2] = c.r;
+void PixelWriter::WritePixelsMasked(const Rectangle<int>& rect, const uint32_t* buf,
+                                    const uint32_t* mask, int pitch) {
+    const auto r = ClipToScreen(rect.pos, rect.size);
+    if (r.size.x == 0) {
+        return;
+    }
+
+    const int offset = pitch * (r.pos.y - rect.pos.y) + (r.pos.x - rect.pos.x);
+    buf += offset;
+    mask += offset;
+    for (int dy = 0; dy < r.size.y; ++dy) {
+        CopyPixelsMasked(PixelAt32(r.pos.x, r.pos.y + dy),
+                         buf + pitch * dy, mask + pitch * dy, r.size.x);
+    }
+    MarkDirty(r.pos, r.size);
+}
+
+void PixelWriter::Move(const Vector2D<int>& dst_pos, const Rectangle<int>& src) {
+    if (src.size.x <= 0 || src.size.y <= 0) {
+        return;
+    }
+
+    if (src.size.x == Pitch() && dst_pos.x == 0 && src.pos.x == 0 && dst_pos.y < src.pos.y) {
+        //whole scan lines are contiguous, so they are moved by a single forward copy.
+        CopyPixels(PixelAt32(0, dst_pos.y), PixelAt32(0, src.pos.y), Pitch() * src.size.y);
+    } else if (dst_pos.y <= src.pos.y) {
+        //moving up: copy from the top line so that we don't overwrite lines not copied yet.
+        for (int dy = 0; dy < src.size.y; ++dy) {
+            CopyPixels(PixelAt32(dst_pos.x, dst_pos.y + dy),
+                       PixelAt32(src.pos.x, src.pos.y + dy), src.size.x);
+        }
+    } else {
+        for (int dy = src.size.y - 1; dy >= 0; --dy) {
+            CopyPixels(PixelAt32(dst_pos.x, dst_pos.y + dy),
+                       PixelAt32(src.pos.x, src.pos.y + dy), src.size.x);
+        }
+    }
+    MarkDirty(dst_pos, src.size);
+}
+
+void PixelWriter::MarkDirtyImpl(const Vector2D<int>& pos, const Vector2D<int>& size) {
+    damage_->Add({pos, size});
 }
 
 void DrawRectangle(PixelWriter& writer, const Vector2D<int>& pos,
                     const Vector2D<int>& size, const PixelColor& c){
-    for (int dx = 0; dx < size.x; ++dx){
-        writer.Write(pos.x + dx, pos.y, c);
-        writer.Write(pos.x + dx, pos.y + size.y - 1, c);
+    if (size.x <= 0 || size.y <= 0) {
+        return;
     }
-
-    for (int dy = 1;dy < size.y - 1; ++dy){
-        writer.Write(pos.x, pos.y + dy, c);
-        writer.Write(pos.x + size.x - 1, pos.y + dy, c);   
-    }       
+    VisitPixelFormat(writer.Format(), [&](auto format) {
+        DrawRectangleImpl<decltype(format)>(writer, pos, size, c);
+    });
+    writer.MarkDirty(pos, size);
 }
 
 void FillRectangle(PixelWriter& writer, const Vector2D<int>& pos,
                    const Vector2D<int>& size, const PixelColor& c) {
-  for (int dy = 0; dy < size.y; ++dy) {
-    for (int dx = 0; dx < size.x; ++dx) {
-      writer.Write(pos.x + dx, pos.y + dy, c);
-    }
-  }
-}
\ No newline at end of file
+  writer.FillRect(pos, size, c);
+}
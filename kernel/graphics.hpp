@@ -1,15 +1,111 @@
 #pragma once
 #include "frame_buffer_config.hpp"
+#include "blit.hpp"
 
 struct PixelColor {
     uint8_t r, g, b;
 };
 
+//struct which represents vector 2
+template <typename T>
+struct Vector2D {
+    T x ,y;
+
+    template <typename U>
+    Vector2D<T>& operator += (const Vector2D<U> &rhs) {
+        x += rhs.x;
+        y += rhs.y;
+        return *this;
+    }
+};
+
+template <typename T>
+struct Rectangle {
+    Vector2D<T> pos, size;
+};
+
+//pixel format policies. they know how a color is stored in the frame buffer.
+//1 pixel is 4 bytes and little endian, so byte 0 is the lowest byte. the reserved byte is 0.
+struct RGBResv8BitPerColorFormat {
+    static uint32_t Pack(const PixelColor& c) {
+        return static_cast<uint32_t>(c.r)
+            | (static_cast<uint32_t>(c.g) << 8)
+            | (static_cast<uint32_t>(c.b) << 16);
+    }
+};
+
+struct BGRResv8BitPerColorFormat {
+    static uint32_t Pack(const PixelColor& c) {
+        return static_cast<uint32_t>(c.b)
+            | (static_cast<uint32_t>(c.g) << 8)
+            | (static_cast<uint32_t>(c.r) << 16);
+    }
+};
+
+//call f with the policy object which corresponds to format.
+//drawing primitives use this once per call, so their inner loops are plain stores.
+template <typename Func>
+auto VisitPixelFormat(PixelFormat format, Func f) {
+    switch (format) {
+        case kPixelRGBResv8BitPerColor:
+            return f(RGBResv8BitPerColorFormat{});
+        case kPixelBGRResv8BitPerColor:
+        default:
+            return f(BGRResv8BitPerColorFormat{});
+    }
+}
+
+class DamageTracker; //defined in shadow_buffer.hpp
+
 class PixelWriter {
     public:
         PixelWriter(const FrameBufferConfig& config) : config_{config}{}
         virtual ~PixelWriter() = default;
         virtual void Write(int x,int y, const PixelColor& c ) = 0;
+
+        //convert the color into the 32 bit value which is stored in the frame buffer as it is.
+        uint32_t Pack(const PixelColor& c) const {
+            return VisitPixelFormat(Format(), [&](auto format) {
+                return decltype(format)::Pack(c);
+            });
+        }
+
+        //when the writer renders into a shadow buffer, every drawing must be recorded here
+        //so that it is copied to the real frame buffer. FillSpan and stores through PixelAt32
+        //don't record anything by themselves, so their callers have to call this.
+        void SetDamageTracker(DamageTracker* damage) { damage_ = damage; }
+        void MarkDirty(const Vector2D<int>& pos, const Vector2D<int>& size) {
+            if (damage_) {
+                MarkDirtyImpl(pos, size);
+            }
+        }
+
+        //write the packed value to width pixels from (x, y) to the right. no clipping.
+        void FillSpan(int x, int y, int width, uint32_t value) {
+            FillPixels(PixelAt32(x, y), value, width);
+        }
+        //fill the rectangle which is clipped to the screen. the color is packed only once.
+        void FillRect(const Vector2D<int>& pos, const Vector2D<int>& size, const PixelColor& c);
+        //copy the pixels in rect to buf whose lines are pitch pixels long, and vice versa.
+        //the part out of the screen is skipped. buf[0] always corresponds to rect.pos.
+        void ReadPixels(const Rectangle<int>& rect, uint32_t* buf, int pitch);
+        void WritePixels(const Rectangle<int>& rect, const uint32_t* buf, int pitch);
+        //same as WritePixels(), but only the pixels whose mask is 0xffffffff are written.
+        void WritePixelsMasked(const Rectangle<int>& rect, const uint32_t* buf,
+                               const uint32_t* mask, int pitch);
+        //copy the pixels in src to dst_pos. src and the destination may overlap
+        //if they are on the same columns (e.g. scrolling). no clipping.
+        void Move(const Vector2D<int>& dst_pos, const Rectangle<int>& src);
+
+        int Width() const { return config_.horizontal_resolution; }
+        int Pitch() const { return config_.pixels_per_scan_line; }
+        int Height() const { return config_.vertical_resolution; }
+        PixelFormat Format() const { return config_.pixel_format; }
+
+        //1 pixel is 4 bytes, so we can access it as uint32_t. no clipping.
+        uint32_t* PixelAt32(int x, int y) {
+            return reinterpret_cast<uint32_t*>(PixelAt(x, y));
+        }
     
     protected:
         uint8_t* PixelAt(int x,int y){
@@ -17,32 +113,32 @@ class PixelWriter {
         }
     
     private:
+        //the part of the rectangle which is in the screen. its size is 0 if nothing is.
+        Rectangle<int> ClipToScreen(const Vector2D<int>& pos, const Vector2D<int>& size) const;
+        void MarkDirtyImpl(const Vector2D<int>& pos, const Vector2D<int>& size);
+
         const FrameBufferConfig& config_;
+        DamageTracker* damage_ = nullptr;
 };
 
-class RGBResv8BitPerColorPixelWriter : public PixelWriter {
+template <typename Format>
+class BasicPixelWriter : public PixelWriter {
     public:
         using PixelWriter::PixelWriter;
-        virtual void Write(int x, int y, const PixelColor& c) override;
+        virtual void Write(int x, int y, const PixelColor& c) override {
+            *PixelAt32(x, y) = Format::Pack(c);
+            MarkDirty({x, y}, {1, 1});
+        }
 };
 
-class BGRResv8BitPerColorPixelWriter : public PixelWriter {
+class RGBResv8BitPerColorPixelWriter : public BasicPixelWriter<RGBResv8BitPerColorFormat> {
     public:
-        using PixelWriter::PixelWriter;
-        virtual void Write(int x, int y, const PixelColor& c) override;
+        using BasicPixelWriter::BasicPixelWriter;
 };
 
-//struct which represents vector 2
-template <typename T>
-struct Vector2D {
-    T x ,y;
-
-    template <typename U>
-    Vector2D<T>& operator += (const Vector2D<U> &rhs) {
-        x += rhs.x;
-        y += rhs.y;
-        return *this;
-    }
+class BGRResv8BitPerColorPixelWriter : public BasicPixelWriter<BGRResv8BitPerColorFormat> {
+    public:
+        using BasicPixelWriter::BasicPixelWriter;
 };
 
 void DrawRectangle(PixelWriter& writer, const Vector2D<int>& pos,
@@ -1,15 +1,80 @@
 #include "logger.hpp"
 
+#include <atomic>
 #include <cstddef>
 #include <cstdio>
 
-#include "console.hpp"
-
 namespace {
-    LogLevel log_level = kWarn;
+    //bounded lock-free queue of log messages (multiple producers, single consumer).
+    //a message longer than a slot is split into several slots.
+    //every variable here is valid when it is zero, because global constructors aren't called.
+    const size_t kLogSlotSize = 128; //including '\0'
+    const size_t kNumLogSlots = 256;
+    static_assert((kNumLogSlots & (kNumLogSlots - 1)) == 0, "kNumLogSlots must be a power of 2");
+
+    struct LogSlot {
+        //turn - index: it tells whether the slot is free or written for the current lap.
+        //(see LoadTurn())
+        std::atomic<size_t> turn;
+        char data[kLogSlotSize];
+    };
+
+    LogSlot log_slots[kNumLogSlots];
+    std::atomic<size_t> log_write_pos; //next position to be reserved by a producer
+    size_t log_read_pos; //only FlushLog() touches it
+    std::atomic<size_t> log_dropped;
+
+    //the slot for position pos is free when its turn is pos,
+    //and it holds a message when its turn is pos + 1.
+    size_t LoadTurn(size_t pos) {
+        const size_t index = pos & (kNumLogSlots - 1);
+        return log_slots[index].turn.load(std::memory_order_acquire) + index;
+    }
+
+    void StoreTurn(size_t pos, size_t turn) {
+        const size_t index = pos & (kNumLogSlots - 1);
+        log_slots[index].turn.store(turn - index, std::memory_order_release);
+    }
+
+    //reserve a slot and copy at most kLogSlotSize - 1 characters. returns the number copied.
+    size_t PushLogSlot(const char* s) {
+        size_t pos = log_write_pos.load(std::memory_order_relaxed);
+        while (true) {
+            const size_t turn = LoadTurn(pos);
+            if (turn == pos) {
+                if (log_write_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (turn < pos + 1) { //the consumer hasn't freed this slot yet
+                log_dropped.fetch_add(1, std::memory_order_relaxed);
+                return 0;
+            } else {
+                pos = log_write_pos.load(std::memory_order_relaxed);
+            }
+        }
+
+        char* data = log_slots[pos & (kNumLogSlots - 1)].data;
+        size_t len = 0;
+        for (; len < kLogSlotSize - 1 && s[len] != '\0'; ++len) {
+            data[len] = s[len];
+        }
+        data[len] = '\0';
+        StoreTurn(pos, pos + 1);
+        return len;
+    }
 }
 
-extern Console* console; //refer to other file(main.cpp)
+namespace {
+    const int kMaxLogSinks = 4;
+    LogSink* log_sinks[kMaxLogSinks];
+    int num_log_sinks;
+
+    void WriteToSinks(const char* s) {
+        for (int i = 0; i < num_log_sinks; ++i) {
+            log_sinks[i] -> Write(s);
+        }
+    }
+}
 
 void SetLogLevel(LogLevel level) {
     log_level = level;
@@ -28,6 +93,52 @@ int Log(LogLevel level, const char* format, ...){
     result = vsprintf(s, format, ap);
     va_end(ap);
 
-    console -> PutString(s);
+    AppendLog(s);
     return result;
-}
\ No newline at end of file
+}
+
+void AppendLog(const char* s) {
+    while (*s) {
+        const size_t len = PushLogSlot(s);
+        if (len == 0) {
+            return;
+        }
+        s += len;
+    }
+}
+
+Error AddLogSink(LogSink* sink) {
+    if (num_log_sinks == kMaxLogSinks) {
+        return MAKE_ERROR(Error::kFull);
+    }
+    log_sinks[num_log_sinks] = sink;
+    ++num_log_sinks;
+    return MAKE_ERROR(Error::kSuccess);
+}
+
+void FlushLog() {
+    if (num_log_sinks == 0) { //keep the messages until someone can output them.
+        return;
+    }
+
+    if (size_t dropped = log_dropped.exchange(0, std::memory_order_relaxed)) {
+        char s[64];
+        sprintf(s, "[%lu log messages dropped]\n", dropped);
+        WriteToSinks(s);
+    }
+
+    while (LoadTurn(log_read_pos) == log_read_pos + 1) {
+        WriteToSinks(log_slots[log_read_pos & (kNumLogSlots - 1)].data);
+        StoreTurn(log_read_pos, log_read_pos + kNumLogSlots); //free for the next lap
+        ++log_read_pos;
+    }
+
+    for (int i = 0; i < num_log_sinks; ++i) {
+        log_sinks[i] -> Flush();
+    }
+}
+
+bool HasPendingLog() {
+    return LoadTurn(log_read_pos) == log_read_pos + 1 ||
+           log_dropped.load(std::memory_order_relaxed) != 0;
+}
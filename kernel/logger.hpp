@@ -6,6 +6,8 @@
 
 #pragma once
 
+#include "error.hpp"
+
 enum LogLevel { //priority
   kError = 3,
   kWarn  = 4,
@@ -13,6 +15,19 @@ enum LogLevel { //priority
   kDebug = 7,
 };
 
+/** @brief コンパイル時のログ優先度の下限．
+ *
+ * これより優先度が低い（数値が大きい）LOG の呼び出しはコードが生成されない．
+ * ビルド時に -DLOG_LEVEL_FLOOR=kWarn のように指定する．
+ */
+#ifndef LOG_LEVEL_FLOOR
+#define LOG_LEVEL_FLOOR kDebug
+#endif
+constexpr LogLevel kLogLevelFloor = LOG_LEVEL_FLOOR;
+
+/** @brief グローバルなログ優先度のしきい値．SetLogLevel() で変更する． */
+inline LogLevel log_level = kWarn;
+
 /** @brief グローバルなログ優先度のしきい値を変更する．
  *
  * グローバルなログ優先度のしきい値を level に設定する．
@@ -28,4 +43,60 @@ void SetLogLevel(LogLevel level);
  * @param level  ログの優先度．しきい値以上の優先度のログのみが記録される．
  * @param format  書式文字列．printk と互換．
  */
-int Log(LogLevel level, const char* format, ...);
\ No newline at end of file
+int Log(LogLevel level, const char* format, ...);
+
+/** @brief ログを記録する．Log() と同じ引数を取る．
+ *
+ * level が kLogLevelFloor より低ければ何も生成されない．
+ * それ以外は，引数を評価する前にしきい値と比較し，記録しない場合は関数呼び出しもしない．
+ * level は定数でなければならない．
+ */
+#define LOG(level, ...) \
+  do { \
+    if constexpr ((level) <= kLogLevelFloor) { \
+      if ((level) <= log_level) { \
+        Log((level), __VA_ARGS__); \
+      } \
+    } \
+  } while (0)
+
+/** @brief ログの出力先．
+ *
+ * FlushLog() はログリングから取り出した文字列を登録されたすべての出力先に渡す．
+ */
+class LogSink {
+ public:
+  virtual ~LogSink() = default;
+  /** @brief 文字列を出力する．実際の描画や送信は Flush() まで遅らせてよい． */
+  virtual void Write(const char* s) = 0;
+  /** @brief Write() で受け取った文字列を描画・送信する．長く待ってはいけない． */
+  virtual void Flush() {}
+};
+
+/** @brief ログの出力先を登録する．
+ *
+ * @return 登録できる数を超えた場合は kFull
+ */
+Error AddLogSink(LogSink* sink);
+
+/** @brief 文字列をログリングに追加する．
+ *
+ * 画面への描画は行わず，次の FlushLog() まで遅延される．
+ * ロックを取らないので，どこから呼んでもよい．
+ * リングが一杯の場合，文字列は捨てられ，その数が次の FlushLog() で報告される．
+ */
+void AppendLog(const char* s);
+
+/** @brief ログリングに溜まった文字列をまとめて出力先に渡す．
+ *
+ * 最後に各出力先の Flush() を呼ぶので，コンソールの描画もここでまとめて行われる．
+ * 出力先が 1 つも登録されていなければ，文字列はリングに残される．
+ * メインループの 1 周ごとなど，描画してもよいタイミングで呼び出す．
+ */
+void FlushLog();
+
+/** @brief 次の FlushLog() で出力すべき文字列があれば true を返す．
+ *
+ * FlushLog() と同じく，ログリングの消費側からのみ呼び出す．
+ */
+bool HasPendingLog();
@@ -6,15 +6,22 @@
 #include <vector>
 
 #include "frame_buffer_config.hpp"
+#include "memory_map.hpp"
 #include "graphics.hpp"
+#include "blit.hpp"
+#include "shadow_buffer.hpp"
 #include "mouse.hpp"
 #include "font.hpp"
 #include "console.hpp"
 #include "pci.hpp"
+#include "acpi.hpp"
 #include "logger.hpp"
+#include "serial.hpp"
+#include "trace.hpp"
 #include "usb/memory.hpp"
 #include "usb/device.hpp"
 #include "usb/classdriver/mouse.hpp"
+#include "usb/classdriver/keyboard.hpp"
 #include "usb/xhci/xhci.hpp"
 #include "usb/xhci/trb.hpp"
 
@@ -26,9 +33,34 @@ const PixelColor kDesktopFGColor{255, 255, 255};
 char pixel_writer_buf[sizeof(RGBResv8BitPerColorPixelWriter)];
 PixelWriter* pixel_writer;
 
+char shadow_buffer_buf[sizeof(ShadowBuffer)];
+ShadowBuffer* shadow_buffer; //nullptr if we draw directly to the frame buffer
+
+char mouse_cursor_buf[sizeof(MouseCursor)];
+MouseCursor* mouse_cursor;
+
 char console_buf[sizeof(Console)];
 Console* console; //global variabl!!
 
+//draw the pending log messages and copy what has been drawn since the last call to the screen.
+void FlushScreen() {
+    //the console scrolls by moving pixels, so take the cursor away while it draws.
+    //it draws the pending log messages and the cells changed since the last flush (e.g. by ScrollBack()).
+    if (mouse_cursor && (HasPendingLog() || (console && console -> HasPendingRedraw()))) {
+        mouse_cursor -> Hide();
+        FlushLog();
+        mouse_cursor -> Show();
+    } else {
+        FlushLog();
+    }
+    if (shadow_buffer) {
+        shadow_buffer -> Flush();
+    }
+}
+
+char serial_port_buf[sizeof(SerialPort)];
+SerialPort* serial_port; //COM1. nullptr if it doesn't exist
+
 int printk(const char* format, ...) { //allocatable args
     va_list ap;
     int result;
@@ -38,22 +70,33 @@ int printk(const char* format, ...) { //allocatable args
     result = vsprintf(s,format,ap);
     va_end(ap);
 
-    console -> PutString(s);
+    AppendLog(s); //rendered later by FlushScreen()
     return result;
 }
 
-char mouse_cursor_buf[sizeof(MouseCursor)];
-MouseCursor* mouse_cursor;
+const int kMaxEventsPerFrame = 64;
 
 void MouseObserver(int8_t displacement_x, int8_t displacement_y) {
-    mouse_cursor -> MoveRelative({displacement_x, displacement_y});
+    mouse_cursor -> AddDisplacement({displacement_x, displacement_y}); //drawn by the main loop
+}
+
+//HID usage IDs of the keys which scroll the console.
+const uint8_t kKeyPageUp = 0x4b, kKeyPageDown = 0x4e;
+
+void KeyboardObserver(uint8_t keycode) {
+    //scroll by half a screen. drawn by the main loop.
+    if (keycode == kKeyPageUp) {
+        console -> ScrollBack(console -> ScrollBackLines() + Console::kRows / 2);
+    } else if (keycode == kKeyPageDown) {
+        console -> ScrollBack(console -> ScrollBackLines() - Console::kRows / 2);
+    }
 }
 
 void SwitchEhci2Xhci(const pci::Device& xhc_dev) {
   bool intel_ehc_exist = false;
-  for (int i = 0; i < pci::num_device; ++i) {
-    if (pci::devices[i].class_code.Match(0x0cu, 0x03u, 0x20u) /* EHCI */ &&
-        0x8086 == pci::ReadVendorId(pci::devices[i])) {
+  for (auto ehc = pci::devices.FindByClass(0x0cu, 0x03u, 0x20u); /* EHCI */
+       ehc; ehc = pci::devices.FindByClass(0x0cu, 0x03u, 0x20u, ehc)) {
+    if (0x8086 == pci::ReadVendorId(*ehc)) {
       intel_ehc_exist = true;
       break;
     }
@@ -66,19 +109,46 @@ void SwitchEhci2Xhci(const pci::Device& xhc_dev) {
   pci::WriteConfReg(xhc_dev, 0xd8, superspeed_ports); // USB3_PSSEN
   uint32_t ehci2xhci_ports = pci::ReadConfReg(xhc_dev, 0xd4); // XUSB2PRM
   pci::WriteConfReg(xhc_dev, 0xd0, ehci2xhci_ports); // XUSB2PR
-  Log(kDebug, "SwitchEhci2Xhci: SS = %02, xHCI = %02x\n",
+  LOG(kDebug, "SwitchEhci2Xhci: SS = %02, xHCI = %02x\n",
       superspeed_ports, ehci2xhci_ports);
 }
 
-extern "C" void KernelMain(const FrameBufferConfig& frame_buffer_config){
-    switch(frame_buffer_config.pixel_format){
+//acpi_table is nullptr if the firmware has no ACPI 2.0 tables.
+extern "C" void KernelMain(const FrameBufferConfig& frame_buffer_config,
+                           const acpi::RSDP* acpi_table,
+                           const MemoryMap& memory_map){
+    InitializeBlit(); //choose SSE2 or AVX2 routines before drawing anything
+    trace::Initialize();
+
+    //the log is also sent to COM1 so that it can be captured in headless boots.
+    serial_port = new(serial_port_buf) SerialPort;
+    if (serial_port -> Initialize(SerialPort::kCOM1, 115200)) {
+        serial_port = nullptr;
+    } else {
+        AddLogSink(serial_port);
+    }
+    //render into the shadow buffer in RAM if there is free memory for the whole screen.
+    const FrameBufferConfig* draw_config = &frame_buffer_config;
+    shadow_buffer = new(shadow_buffer_buf) ShadowBuffer;
+    if (auto err = shadow_buffer -> Initialize(frame_buffer_config, memory_map)) {
+        LOG(kWarn, "shadow buffer disabled, drawing to the frame buffer directly: %s\n",
+            err.Name());
+        shadow_buffer = nullptr;
+    } else {
+        draw_config = &shadow_buffer -> Config();
+    }
+
+    switch(draw_config -> pixel_format){
         case kPixelRGBResv8BitPerColor:
-            pixel_writer = new(pixel_writer_buf)RGBResv8BitPerColorPixelWriter{frame_buffer_config};
+            pixel_writer = new(pixel_writer_buf)RGBResv8BitPerColorPixelWriter{*draw_config};
             break;
         case kPixelBGRResv8BitPerColor:
-            pixel_writer = new(pixel_writer_buf)BGRResv8BitPerColorPixelWriter{frame_buffer_config};
+            pixel_writer = new(pixel_writer_buf)BGRResv8BitPerColorPixelWriter{*draw_config};
             break;
     }
+    if (shadow_buffer) {
+        pixel_writer -> SetDamageTracker(&shadow_buffer -> Damage());
+    }
 
     const int kFrameWidth = frame_buffer_config.horizontal_resolution;
     const int kFrameHeight = frame_buffer_config.vertical_resolution;
@@ -105,49 +175,76 @@ extern "C" void KernelMain(const FrameBufferConfig& frame_buffer_config){
 
     // to use console as an global variable(it's defined at l20)
     console = new(console_buf) Console(*pixel_writer, kDesktopFGColor, kDesktopBGColor); //allocate console in global area
+    AddLogSink(console);
 
     printk("Welcome to MikanOS!\n");
+    //tools/tracedump.py can decode a dump of this area.
+    LOG(kInfo, "trace rings: %p, %lu bytes\n", trace::rings, sizeof(trace::rings));
 
     mouse_cursor = new(mouse_cursor_buf) MouseCursor {
-        pixel_writer, kDesktopBGColor, {300,200}
+        pixel_writer, {300,200}
     };
+    FlushScreen();
+
+    if (auto err = acpi::Initialize(acpi_table)) {
+        LOG(kWarn, "ACPI tables are not available: %s\n", err.Name());
+    }
+    //use memory mapped config space if the firmware tells us where it is.
+    if (pci::InitializeEcam(acpi::mcfg)) {
+        LOG(kInfo, "PCI config space: IO port\n");
+    } else {
+        LOG(kInfo, "PCI config space: ECAM\n");
+    }
+    FlushScreen(); //show each boot stage before the next one, which may hang
+
+    //page-sized and larger DMA buffers of the USB driver come from the free memory.
+    //the shadow buffer has already taken its pages from there.
+    const size_t dma_bytes = shadow_buffer
+        ? usb::AddFreeMemory(memory_map, shadow_buffer -> BufferStart(),
+                             shadow_buffer -> BufferBytes())
+        : usb::AddFreeMemory(memory_map, 0, 0);
+    LOG(kInfo, "USB DMA memory: %lu KiB\n", dma_bytes / 1024);
 
     auto err = pci::ScanAllBus();
-    Log(kDebug, "ScanAllBus: %s\n", err.Name());
+    LOG(kDebug, "ScanAllBus: %s, %lu devices, %lu config reads\n",
+        err.Name(), pci::devices.Size(), pci::NumConfigReads());
     
-    for (int i = 0;i < pci::num_device; ++i) {
+    for (size_t i = 0;i < pci::devices.Size(); ++i) {
         const auto& dev = pci::devices[i];
-        auto vendor_id = pci::ReadVendorId(dev);
-        auto class_code = pci::ReadClassCode(dev.bus, dev.device, dev.function);
-        Log(kDebug, "%d.%d.%d: vend %04x, class %08x, head %02x\n",
+        LOG(kDebug, "%d.%d.%d: vend %04x, class %02x%02x%02x, head %02x\n",
         dev.bus, dev.device, dev.function,
-        vendor_id, class_code, dev.header_type);
+        dev.vendor_id, dev.class_code.base, dev.class_code.sub, dev.class_code.interface,
+        dev.header_type);
     }
+    FlushScreen();
     //look for xHC.
     pci::Device* xhc_dev = nullptr;
-    for (int i = 0; i < pci::num_device ; ++i) {
-        if (pci::devices[i].class_code.Match(0x0cu, 0x03u, 0x30u)) { //it means xHCl(ref p151)
-            xhc_dev = &pci::devices[i];
+    for (auto dev = pci::devices.FindByClass(0x0cu, 0x03u, 0x30u); //it means xHCl(ref p151)
+         dev; dev = pci::devices.FindByClass(0x0cu, 0x03u, 0x30u, dev)) {
+        xhc_dev = dev;
 
-            if (0x8086 == pci::ReadVendorId(*xhc_dev)) { //adopt made intel 
-                break;
-            }
+        if (0x8086 == pci::ReadVendorId(*xhc_dev)) { //adopt made intel 
+            break;
         }
     }
 
     if(xhc_dev) {
-        Log(kInfo, "xHC has been found: %d.%d.%d\n",
+        LOG(kInfo, "xHC has been found: %d.%d.%d\n",
             xhc_dev -> bus, xhc_dev -> device, xhc_dev -> function);
+        //MSI / MSI-X can be configured once we have an IDT and the local APIC.
+        for (auto cap : pci::Capabilities(*xhc_dev)) {
+            LOG(kDebug, "xHC capability %02x at %02x\n", cap.header.bits.cap_id, cap.offset);
+        }
     }
 
     //get MMIO(memory mapped io) registers address which control xHC(host controller)
     //MMIO address should be registered in BAR0 in configuration space.
 
     const WithError<uint64_t> xhc_bar = pci::ReadBar(*xhc_dev, 0); //xhc_dev contains address which points to MMIO in xHC.
-    Log(kDebug, "ReadBar: %s\n", xhc_bar.error.Name());
+    LOG(kDebug, "ReadBar: %s\n", xhc_bar.error.Name());
     //xhc_bar.value represents the address which points to head xHC registers.
     const uint64_t xhc_mmio_base = xhc_bar.value & ~static_cast <uint64_t> (0xf); //ref p 159
-    Log(kDebug, "xHC mmio_base = %08lx\n", xhc_mmio_base);
+    LOG(kDebug, "xHC mmio_base = %08lx\n", xhc_mmio_base);
 
     //initialize //this class controls host controller.
     usb::xhci::Controller xhc{xhc_mmio_base};
@@ -155,35 +252,47 @@ extern "C" void KernelMain(const FrameBufferConfig& frame_buffer_config){
     if(0x8086 == pci::ReadVendorId(*xhc_dev)) {
         SwitchEhci2Xhci(*xhc_dev);
     }
+    FlushScreen();
     {
         auto err = xhc.Initialize();
-        Log(kDebug, "xhc.Initialize: %s\n",err.Name());
+        LOG(kDebug, "xhc.Initialize: %s\n",err.Name());
     }
+    FlushScreen();
 
-    Log(kInfo, "xHC strting\n");
+    LOG(kInfo, "xHC strting\n");
     xhc.Run();
+    FlushScreen();
 
     //configure_part
     usb::HIDMouseDriver::default_observer = MouseObserver; //this is class driver for USB mouse(ref p155)
+    usb::HIDKeyboardDriver::default_observer = KeyboardObserver; //PageUp / PageDown scroll the console back
 
     for (int i = 1; i <= xhc.MaxPorts() ; ++i) {
         auto port = xhc.PortAt(i);
-        Log(kDebug, "Port %d: IsConnected = %d\n", i, port.IsConnected());
+        LOG(kDebug, "Port %d: IsConnected = %d\n", i, port.IsConnected());
 
         if (port.IsConnected()) {
             if (auto err = ConfigurePort(xhc, port)) { //ADL
-                Log(kError, "failed to configure port: %s at %s:%d\n",
+                LOG(kError, "failed to configure port: %s at %s:%d\n",
                 err.Name(), err.File(), err.Line());
             continue;
             }
         }
     }
 
+    FlushScreen();
+
     while (1) {
-        if (auto err = ProcessEvent(xhc)) {
-            Log(kError, "Error while ProceEvent: %s at %s:%d\n",
-                err.Name(),err.File(),err.Line());
+        //handle the events which have arrived so far, then draw once for all of them.
+        //the events are bounded so that a flood of reports can't stop the screen.
+        for (int i = 0; i < kMaxEventsPerFrame && xhc.PrimaryEventRing()->HasFront(); ++i) {
+            if (auto err = ProcessEvent(xhc)) {
+                LOG(kError, "Error while ProceEvent: %s at %s:%d\n",
+                    err.Name(),err.File(),err.Line());
+            }
         }
+        mouse_cursor -> Update();
+        FlushScreen();
     }
 
     while (1) __asm__("hlt");
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdint.h>
+
+//the memory map which the loader got from UEFI just before ExitBootServices().
+//the loader has a copy of this file.
+struct MemoryMap {
+  unsigned long long buffer_size;
+  void* buffer; //array of descriptors. each is descriptor_size bytes long.
+  unsigned long long map_size;
+  unsigned long long map_key;
+  unsigned long long descriptor_size;
+  uint32_t descriptor_version;
+};
+
+//EFI_MEMORY_DESCRIPTOR
+struct MemoryDescriptor {
+  uint32_t type;
+  uintptr_t physical_start;
+  uintptr_t virtual_start;
+  uint64_t number_of_pages; //4 KiB pages
+  uint64_t attribute;
+};
+
+#ifdef __cplusplus
+enum class MemoryType {
+  kEfiReservedMemoryType,
+  kEfiLoaderCode,
+  kEfiLoaderData,
+  kEfiBootServicesCode,
+  kEfiBootServicesData,
+  kEfiRuntimeServicesCode,
+  kEfiRuntimeServicesData,
+  kEfiConventionalMemory,
+  kEfiUnusableMemory,
+  kEfiACPIReclaimMemory,
+  kEfiACPIMemoryNVS,
+  kEfiMemoryMappedIO,
+  kEfiMemoryMappedIOPortSpace,
+  kEfiPalCode,
+  kEfiPersistentMemory,
+  kEfiMaxMemoryType
+};
+
+inline bool operator==(uint32_t lhs, MemoryType rhs) {
+  return lhs == static_cast<uint32_t>(rhs);
+}
+
+inline bool operator==(MemoryType lhs, uint32_t rhs) {
+  return rhs == lhs;
+}
+
+const int kUEFIPageSize = 4096;
+#endif
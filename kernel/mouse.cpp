@@ -1,11 +1,13 @@
 #include "mouse.hpp"
 
+#include <algorithm>
+
 #include "graphics.hpp"
 
 namespace {
     const int kMouseCursorWidth = 15;
     const int kMouseCursorHeight = 24;
-    const char mouse_cursor_shape[kMouseCursorHeight][kMouseCursorWidth + 1] = {
+    const char* const mouse_cursor_shape[kMouseCursorHeight] = {
         "@              ",
         "@@             ",
         "@.@            ",
@@ -32,40 +34,81 @@ namespace {
         "         @@@   ",
     };
 
-    void DrawMouseCursor(PixelWriter* pixel_writer, Vector2D<int> position) {
-        for (int dy = 0; dy < kMouseCursorHeight; ++dy) {
-            for (int dx = 0; dx < kMouseCursorWidth; ++dx) {
-                if (mouse_cursor_shape[dy][dx] == '@') {
-                    pixel_writer->Write(position.x + dx, position.y + dy, {0, 0, 0});
-                } else if (mouse_cursor_shape[dy][dx] == '.') {
-                    pixel_writer->Write(position.x + dx, position.y + dy, {255, 255, 255});
-                }
+    template <typename Format>
+    void RasterizeCursor(const char* const* shape, int width, int height,
+                         uint32_t (*sprite)[kMouseCursorMaxWidth],
+                         uint32_t (*mask)[kMouseCursorMaxWidth]) {
+        const uint32_t edge = Format::Pack({0, 0, 0});
+        const uint32_t fill = Format::Pack({255, 255, 255});
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                const char c = shape[y][x];
+                sprite[y][x] = c == '@' ? edge : c == '.' ? fill : 0;
+                mask[y][x] = c == '@' || c == '.' ? 0xffffffffu : 0;
             }
         }
     }
-
-    void EraseMouseCursor(PixelWriter* pixel_writer, Vector2D<int> position,
-                        PixelColor erase_color) {
-        for (int dy = 0; dy < kMouseCursorHeight; ++dy) {
-            for (int dx = 0; dx < kMouseCursorWidth; ++dx) {
-                if (mouse_cursor_shape[dy][dx] != ' ') {
-                    pixel_writer->Write(position.x + dx, position.y + dy, erase_color);
-                }
-            }
-        }   
-    }
 }
 
-MouseCursor::MouseCursor(PixelWriter* writer, PixelColor erase_color,
-                        Vector2D<int> initial_position)
+MouseCursor::MouseCursor(PixelWriter* writer, Vector2D<int> initial_position)
         : pixel_writer_{writer},
-          erase_color_{erase_color},
           position_{initial_position} {
-    DrawMouseCursor(pixel_writer_, position_);
+    SetShape(mouse_cursor_shape, kMouseCursorWidth, kMouseCursorHeight);
+    Show();
 }
 
 void MouseCursor::MoveRelative(Vector2D<int> displacement) {
-    EraseMouseCursor(pixel_writer_, position_, erase_color_);
+    Hide();
     position_ += displacement;
-    DrawMouseCursor(pixel_writer_, position_);
-}
\ No newline at end of file
+    position_.x = std::clamp(position_.x, 0, pixel_writer_->Width() - 1);
+    position_.y = std::clamp(position_.y, 0, pixel_writer_->Height() - 1);
+    Show();
+}
+
+void MouseCursor::AddDisplacement(Vector2D<int> displacement) {
+    pending_displacement_ += displacement;
+}
+
+void MouseCursor::Update() {
+    if (pending_displacement_.x == 0 && pending_displacement_.y == 0) {
+        return;
+    }
+    MoveRelative(pending_displacement_);
+    pending_displacement_ = {0, 0};
+}
+
+Error MouseCursor::SetShape(const char* const* shape, int width, int height) {
+    if (width <= 0 || width > kMouseCursorMaxWidth ||
+        height <= 0 || height > kMouseCursorMaxHeight) {
+        return MAKE_ERROR(Error::kIndexOutOfRange);
+    }
+
+    const bool visible = visible_;
+    Hide();
+    VisitPixelFormat(pixel_writer_->Format(), [&](auto format) {
+        RasterizeCursor<decltype(format)>(shape, width, height, sprite_, mask_);
+    });
+    size_ = {width, height};
+    if (visible) {
+        Show();
+    }
+    return MAKE_ERROR(Error::kSuccess);
+}
+
+void MouseCursor::Hide() {
+    if (!visible_) {
+        return;
+    }
+    pixel_writer_->WritePixels({position_, size_}, &save_under_[0][0], kMouseCursorMaxWidth);
+    visible_ = false;
+}
+
+void MouseCursor::Show() {
+    if (visible_) {
+        return;
+    }
+    pixel_writer_->ReadPixels({position_, size_}, &save_under_[0][0], kMouseCursorMaxWidth);
+    pixel_writer_->WritePixelsMasked({position_, size_}, &sprite_[0][0], &mask_[0][0],
+                                     kMouseCursorMaxWidth);
+    visible_ = true;
+}
@@ -1,15 +1,46 @@
 #pragma once
 
+#include "error.hpp"
 #include "graphics.hpp"
 
+//the largest cursor shape SetShape() accepts
+const int kMouseCursorMaxWidth = 32;
+const int kMouseCursorMaxHeight = 32;
+
 class MouseCursor {
     public:
-        MouseCursor(PixelWriter* writer, PixelColor erase_color,
-            Vector2D<int> initial_position);
+        //the cursor starts with the default arrow shape.
+        MouseCursor(PixelWriter* writer, Vector2D<int> initial_position);
+        //move the cursor now. the position is clamped so that the tip stays on the screen.
         void MoveRelative(Vector2D<int> displacement);
 
+        //add a displacement reported by the mouse. nothing is drawn until Update(),
+        //so many reports between two frames cost only one redraw.
+        void AddDisplacement(Vector2D<int> displacement);
+        //move the cursor by the sum of the displacements added since the last call.
+        void Update();
+
+        //replace the cursor shape. shape has height lines of width characters:
+        //'@' is black, '.' is white and any other character is transparent.
+        //the shape is converted to pixels here, so drawing doesn't look at it again.
+        Error SetShape(const char* const* shape, int width, int height);
+
+        //take the cursor away from the screen, restoring the pixels under it.
+        //draw under the cursor only while it is hidden, otherwise the saved pixels get stale.
+        void Hide();
+        //save the pixels under the cursor and draw it.
+        void Show();
+
     private:
         PixelWriter* pixel_writer_ = nullptr;
-        PixelColor erase_color_;
         Vector2D<int> position_;
-};
\ No newline at end of file
+        bool visible_ = false;
+        Vector2D<int> pending_displacement_{0, 0};
+
+        //the cursor shape packed in the pixel format of the screen.
+        //a pixel is drawn where its mask is 0xffffffff. only size_ of them are used.
+        Vector2D<int> size_;
+        uint32_t sprite_[kMouseCursorMaxHeight][kMouseCursorMaxWidth];
+        uint32_t mask_[kMouseCursorMaxHeight][kMouseCursorMaxWidth];
+        uint32_t save_under_[kMouseCursorMaxHeight][kMouseCursorMaxWidth]; //the pixels under the cursor
+};
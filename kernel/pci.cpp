@@ -1,5 +1,7 @@
 #include "pci.hpp"
 
+#include <atomic>
+
 #include "asmfunc.h"
 
 namespace { //internal linkage(= can't be accessed by other file)
@@ -20,48 +22,188 @@ namespace { //internal linkage(= can't be accessed by other file)
             | (reg_addr & 0xfcu); //offset(2bit is 0)
     }
 
+    //the ECAM area of segment 0. config space of bus b is at ecam_base + (b - ecam_start_bus) << 20.
+    //ecam_base is nullptr until InitializeEcam() succeeds.
+    volatile uint8_t* ecam_base;
+    uint8_t ecam_start_bus, ecam_end_bus;
+
+    volatile uint32_t* EcamRegister(uint8_t bus, uint8_t device,
+                                    uint8_t function, uint16_t reg_addr) {
+        if (ecam_base == nullptr || bus < ecam_start_bus || bus > ecam_end_bus) {
+            return nullptr;
+        }
+        const uintptr_t offset = (static_cast<uintptr_t>(bus - ecam_start_bus) << 20)
+            | (static_cast<uintptr_t>(device) << 15)
+            | (static_cast<uintptr_t>(function) << 12)
+            | (reg_addr & 0xffcu);
+        return reinterpret_cast<volatile uint32_t*>(ecam_base + offset);
+    }
+
+    //every config space access goes through these two.
+    //ECAM needs 1 memory access, the IO port needs 2 and can't reach beyond 256 bytes.
+    std::atomic<uint64_t> num_config_reads;
+
+    uint32_t ReadConf32(uint8_t bus, uint8_t device, uint8_t function, uint16_t reg_addr) {
+        num_config_reads.fetch_add(1, std::memory_order_relaxed);
+        if (auto reg = EcamRegister(bus, device, function, reg_addr)) {
+            return *reg;
+        }
+        if (reg_addr >= 256) {
+            return 0xffffffffu;
+        }
+        WriteAddress(MakeAddress(bus, device, function, reg_addr));
+        return ReadData();
+    }
+
+    void WriteConf32(uint8_t bus, uint8_t device, uint8_t function,
+                     uint16_t reg_addr, uint32_t value) {
+        if (auto reg = EcamRegister(bus, device, function, reg_addr)) {
+            *reg = value;
+            return;
+        }
+        if (reg_addr >= 256) {
+            return;
+        }
+        WriteAddress(MakeAddress(bus, device, function, reg_addr));
+        WriteData(value);
+    }
+
     Error AddDevice(const Device& device) {
-        if (num_device == devices.size()){
-            return MAKE_ERROR(Error::kFull);
+        return devices.Add(device);
+    }
+
+    //chunks for DeviceRegistry. replace this with a heap when we have one.
+    DeviceRegistry::Chunk device_chunk_pool[DeviceRegistry::kMaxChunks];
+    size_t num_device_chunks;
+
+    DeviceRegistry::Chunk* AllocateDeviceChunk() {
+        if (num_device_chunks == DeviceRegistry::kMaxChunks) {
+            return nullptr;
         }
+        return &device_chunk_pool[num_device_chunks++];
+    }
 
-        devices[num_device] = device;
-        ++num_device;
-        return MAKE_ERROR(Error::kSuccess);
+    size_t ClassBucket(uint8_t base, uint8_t sub, uint8_t interface) {
+        return ((base * 31u + sub) * 31u + interface) % DeviceRegistry::kNumBuckets;
     }
 
-    Error ScanBus(uint8_t bus);
+    size_t IdBucket(uint16_t vendor_id, uint16_t device_id) {
+        return (vendor_id * 31u + device_id) % DeviceRegistry::kNumBuckets;
+    }
+
+    //buses waiting to be scanned. ScanAllBus() scans breadth first: scanning a bus
+    //queues the secondary buses of the bridges on it. a bus is queued at most once,
+    //so 256 slots are enough and the queue never wraps.
+    //every bus also remembers which bus range it belongs to: the root range, the
+    //[secondary, subordinate] range of a bridge, or none (out of the scan).
+    //the queue is only used by the boot CPU.
+    class BusQueue {
+        public:
+            //start over with [first, last] as the root range.
+            void Clear(uint8_t first, uint8_t last) {
+                queued_.fill(0);
+                range_.fill(kNoRange);
+                for (int bus = first; bus <= last; ++bus) {
+                    range_[bus] = kRootRange;
+                }
+                head_ = tail_ = 0;
+            }
+
+            //returns false if the bus has been queued already.
+            bool Push(uint8_t bus) {
+                const uint32_t bit = 1u << (bus % 32);
+                if (queued_[bus / 32] & bit) {
+                    return false;
+                }
+                queued_[bus / 32] |= bit;
+                slots_[tail_++] = bus;
+                return true;
+            }
+
+            //take a bus to scan. returns -1 if there is nothing left.
+            int Pop() {
+                return head_ < tail_ ? slots_[head_++] : -1;
+            }
 
-    Error ScanFunction(uint8_t bus, uint8_t device, uint8_t function) { //register (bus,device,function) to devices array.
-        auto class_code = ReadClassCode(bus,device,function);
-        auto header_type = ReadHeaderType(bus,device,function);
-        Device dev{bus, device, function, header_type, class_code};
+            //give [secondary, subordinate] to a bridge on bus and queue its secondary bus.
+            //the range must lie in the range of bus and must not overlap one which another
+            //bridge has taken already. otherwise the bridge is ignored and false is returned.
+            bool Claim(uint8_t bus, uint8_t secondary, uint8_t subordinate) {
+                if (secondary <= bus || subordinate < secondary) { //not configured by the firmware
+                    return false;
+                }
+                const uint16_t parent = range_[bus];
+                for (int b = secondary; b <= subordinate; ++b) {
+                    if (range_[b] != parent) {
+                        return false;
+                    }
+                }
+                for (int b = secondary; b <= subordinate; ++b) {
+                    range_[b] = secondary + kBridgeRange;
+                }
+                return Push(secondary);
+            }
+
+            //true if bus is in the root range, not behind a bridge and not queued yet.
+            bool IsUnreachedRoot(uint8_t bus) const {
+                return range_[bus] == kRootRange && (queued_[bus / 32] & (1u << (bus % 32))) == 0;
+            }
+
+        private:
+            static const uint16_t kNoRange = 0, kRootRange = 1, kBridgeRange = 2; //secondary bus + 2
+
+            std::array<uint32_t, 8> queued_; //bitmap of the buses pushed so far
+            std::array<uint8_t, 256> slots_;
+            std::array<uint16_t, 256> range_;
+            size_t head_, tail_;
+    };
+
+    BusQueue bus_queue;
+
+    //register the function whose first dword has been read and queue the bus behind it if it's a bridge.
+    Error ScanFunction(uint8_t bus, uint8_t device, uint8_t function, uint32_t reg0,
+                       uint8_t& header_type) {
+        //read the whole standard header once. later queries are served from this copy.
+        Device dev{bus, device, function};
+        dev.header[0] = reg0;
+        for (size_t i = 1; i < kConfigHeaderDwords; ++i) {
+            dev.header[i] = ReadConf32(bus, device, function, 4 * i);
+        }
+        dev.vendor_id = dev.header[0] & 0xffffu;
+        dev.device_id = dev.header[0] >> 16;
+        dev.header_type = header_type = (dev.header[3] >> 16) & 0xffu;
+        dev.class_code.base = (dev.header[2] >> 24) & 0xffu;
+        dev.class_code.sub = (dev.header[2] >> 16) & 0xffu;
+        dev.class_code.interface = (dev.header[2] >> 8) & 0xffu;
         if (auto err = AddDevice(dev)) {
             return err;
         }
 
-        if(class_code.Match(0x06u, 0x04u)) {
-            auto bus_numbers = ReadBusNumbers(bus, device, function);
+        if(dev.class_code.Match(0x06u, 0x04u)) {
+            auto bus_numbers = dev.header[0x18 / 4];
             uint8_t secondary_bus = (bus_numbers >> 8) & 0xffu;
-            return ScanBus(secondary_bus);
+            uint8_t subordinate_bus = (bus_numbers >> 16) & 0xffu;
+            bus_queue.Claim(bus, secondary_bus, subordinate_bus);
         }
 
         return MAKE_ERROR(Error::kSuccess);
     }
 
-    Error ScanDevice(uint8_t bus, uint8_t device) {
-        if (auto err = ScanFunction(bus, device, 0)) { //the result of expression is err!
+    Error ScanDevice(uint8_t bus, uint8_t device, uint32_t reg0) {
+        uint8_t header_type;
+        if (auto err = ScanFunction(bus, device, 0, reg0, header_type)) { //the result of expression is err!
             return err;
         }
-        if ( IsSingleFunctionDevice(ReadHeaderType(bus, device, 0))) {
+        if ( IsSingleFunctionDevice(header_type)) {
             return MAKE_ERROR(Error::kSuccess);
         }
 
         for (uint8_t function = 1; function < 8; ++ function) {
-            if ( ReadVendorId(bus, device, function) == 0xffffu) {
+            const uint32_t reg = ReadConf32(bus, device, function, 0x00);
+            if ((reg & 0xffffu) == 0xffffu) {
                 continue;
             }
-            if(auto err = ScanFunction(bus,device,function)) {
+            if(auto err = ScanFunction(bus, device, function, reg, header_type)) {
                 return err;
             }
         }
@@ -70,10 +212,21 @@ namespace { //internal linkage(= can't be accessed by other file)
 
     Error ScanBus(uint8_t bus) {
         for (uint8_t device = 0; device < 32; ++ device){ // there are at most 32 devices connected to PCI device.
-            if(ReadVendorId(bus,device,0) == 0xffffu) { //to check whether there is a device.
+            const uint32_t reg = ReadConf32(bus, device, 0, 0x00);
+            if((reg & 0xffffu) == 0xffffu) { //to check whether there is a device.
                 continue;
             }
-            if(auto err = ScanDevice(bus, device)) {
+            if(auto err = ScanDevice(bus, device, reg)) {
+                return err;
+            }
+        }
+        return MAKE_ERROR(Error::kSuccess);
+    }
+
+    //scan the queued buses until all of them, including the ones queued meanwhile, are done.
+    Error ScanQueuedBuses() {
+        for (int bus = bus_queue.Pop(); bus >= 0; bus = bus_queue.Pop()) {
+            if (auto err = ScanBus(bus)) {
                 return err;
             }
         }
@@ -83,6 +236,27 @@ namespace { //internal linkage(= can't be accessed by other file)
 }
 
 namespace pci {
+    Error InitializeEcam(const acpi::MCFG* mcfg) {
+        if (mcfg == nullptr) {
+            return MAKE_ERROR(Error::kUnknownDevice);
+        }
+        for (size_t i = 0; i < mcfg->Count(); ++i) {
+            const auto& entry = (*mcfg)[i];
+            if (entry.segment_group != 0) { //we don't support multiple segments
+                continue;
+            }
+            ecam_base = reinterpret_cast<volatile uint8_t*>(entry.base_address);
+            ecam_start_bus = entry.start_bus;
+            ecam_end_bus = entry.end_bus;
+            return MAKE_ERROR(Error::kSuccess);
+        }
+        return MAKE_ERROR(Error::kUnknownDevice);
+    }
+
+    bool EcamEnabled() {
+        return ecam_base != nullptr;
+    }
+
     void WriteAddress(uint32_t address) { //output the data in eax to the area
         IoOut32(kConfigAddress, address); //address is set to the memory in kConfigAddress.
     }
@@ -96,24 +270,19 @@ namespace pci {
     }
 
     uint16_t ReadVendorId(uint8_t bus, uint8_t device, uint8_t function) {
-        //if I set the kConfigAddress , kConfigData which corrspond with kConfigAddress is imported automatically??
-        WriteAddress(MakeAddress(bus, device, function, 0x00));
-        return ReadData() & 0xffffu;
+        return ReadConf32(bus, device, function, 0x00) & 0xffffu;
     }
 
     uint16_t ReadDeviceId(uint8_t bus, uint8_t device, uint8_t function) {
-        WriteAddress(MakeAddress(bus, device, function, 0x00));
-        return ReadData() >> 16;
+        return ReadConf32(bus, device, function, 0x00) >> 16;
   }
 
     uint8_t ReadHeaderType(uint8_t bus, uint8_t device, uint8_t function) {
-        WriteAddress(MakeAddress(bus, device, function, 0x0c));
-        return (ReadData() >> 16) & 0xffu;
+        return (ReadConf32(bus, device, function, 0x0c) >> 16) & 0xffu;
   }
 
     ClassCode ReadClassCode(uint8_t bus, uint8_t device, uint8_t function) {
-        WriteAddress(MakeAddress(bus, device, function, 0x08));
-        auto reg = ReadData();
+        auto reg = ReadConf32(bus, device, function, 0x08);
         ClassCode cc;
         cc.base = (reg >> 24) & 0xffu;
         cc.sub = (reg >> 16) & 0xffu;
@@ -122,51 +291,143 @@ namespace pci {
   }
 
     uint32_t ReadBusNumbers(uint8_t bus, uint8_t device, uint8_t function) {
-        WriteAddress(MakeAddress(bus, device, function, 0x18));
-        return ReadData();
+        return ReadConf32(bus, device, function, 0x18);
   }
 
     bool IsSingleFunctionDevice(uint8_t header_type) {
         return (header_type & 0x80u) == 0; //bit 7 of header type represents this device is multi function device
 }
 
-    Error ScanAllBus() { //search for device connented to PCI bus recursively.
-        num_device = 0;
+    void DeviceRegistry::Clear() {
+        size_ = 0;
+        class_buckets_.fill(0);
+        id_buckets_.fill(0);
+        class_tails_.fill(0);
+        id_tails_.fill(0);
+    }
 
-        auto header_type = ReadHeaderType(0,0,0); //necessairily there is 0 number funciton.
-        if (IsSingleFunctionDevice(header_type)) { //it's in charge of 0 bus,
-            return ScanBus(0);
+    Error DeviceRegistry::Add(const Device& device) {
+        if (size_ == num_chunks_ * kChunkSize) {
+            auto chunk = AllocateDeviceChunk();
+            if (chunk == nullptr) {
+                return MAKE_ERROR(Error::kFull);
+            }
+            chunks_[num_chunks_++] = chunk;
         }
 
-        for(uint8_t function = 0;function < 8; ++function){
-            if(ReadVendorId(0,0,function) == 0xffffu) { //ref p143( to check if there is this "funciton".)
-                continue;
+        auto& entry = EntryAt(size_);
+        entry.device = device;
+        entry.next_by_class = entry.next_by_id = 0;
+        ++size_;
+
+        //append at the tail so that lookups return devices in the scan order.
+        const auto& cc = device.class_code;
+        const size_t class_bucket = ClassBucket(cc.base, cc.sub, cc.interface);
+        if (auto tail = class_tails_[class_bucket]) {
+            EntryAt(tail - 1).next_by_class = size_;
+        } else {
+            class_buckets_[class_bucket] = size_;
+        }
+        class_tails_[class_bucket] = size_;
+
+        const size_t id_bucket = IdBucket(device.vendor_id, device.device_id);
+        if (auto tail = id_tails_[id_bucket]) {
+            EntryAt(tail - 1).next_by_id = size_;
+        } else {
+            id_buckets_[id_bucket] = size_;
+        }
+        id_tails_[id_bucket] = size_;
+        return MAKE_ERROR(Error::kSuccess);
+    }
+
+    //Entry starts with its Device, so a Device in the registry tells where its Entry is.
+    Device* DeviceRegistry::FindByClass(uint8_t base, uint8_t sub, uint8_t interface,
+                                        const Device* after) {
+        uint32_t next = after
+            ? reinterpret_cast<const Entry*>(after)->next_by_class
+            : class_buckets_[ClassBucket(base, sub, interface)];
+        for (; next != 0; next = EntryAt(next - 1).next_by_class) {
+            auto& dev = EntryAt(next - 1).device;
+            if (dev.class_code.Match(base, sub, interface)) {
+                return &dev;
+            }
+        }
+        return nullptr;
+    }
+
+    Device* DeviceRegistry::FindById(uint16_t vendor_id, uint16_t device_id,
+                                     const Device* after) {
+        uint32_t next = after
+            ? reinterpret_cast<const Entry*>(after)->next_by_id
+            : id_buckets_[IdBucket(vendor_id, device_id)];
+        for (; next != 0; next = EntryAt(next - 1).next_by_id) {
+            auto& dev = EntryAt(next - 1).device;
+            if (dev.vendor_id == vendor_id && dev.device_id == device_id) {
+                return &dev;
             }
+        }
+        return nullptr;
+    }
 
-            if (auto err = ScanBus(function)) {
+    Error ScanAllBus() { //search for device connented to PCI bus breadth first.
+        devices.Clear();
+
+        if (ecam_base != nullptr) {
+            //MCFG tells the bus range of the segment. the first bus is the root;
+            //the buses behind its bridges are reached through them.
+            bus_queue.Clear(ecam_start_bus, ecam_end_bus);
+            bus_queue.Push(ecam_start_bus);
+            if (auto err = ScanQueuedBuses()) {
                 return err;
             }
+            //a bus which no bridge covers may belong to another host bridge.
+            //one read of device 0 tells if there is something on it.
+            for (int bus = ecam_start_bus + 1; bus <= ecam_end_bus; ++bus) {
+                if (!bus_queue.IsUnreachedRoot(bus) || ReadVendorId(bus, 0, 0) == 0xffffu) {
+                    continue;
+                }
+                bus_queue.Push(bus);
+                if (auto err = ScanQueuedBuses()) {
+                    return err;
+                }
+            }
+            return MAKE_ERROR(Error::kSuccess);
+        }
+
+        bus_queue.Clear(0, 255);
+        auto header_type = ReadHeaderType(0,0,0); //necessairily there is 0 number funciton.
+        if (IsSingleFunctionDevice(header_type)) { //it's in charge of 0 bus,
+            bus_queue.Push(0);
+        } else {
+            for(uint8_t function = 0;function < 8; ++function){
+                if(ReadVendorId(0,0,function) == 0xffffu) { //ref p143( to check if there is this "funciton".)
+                    continue;
+                }
+                bus_queue.Push(function); //host bridge n is in charge of bus n
+            }
         }
-        return MAKE_ERROR(Error::kSuccess);
+        return ScanQueuedBuses();
     }
 
-    uint32_t ReadConfReg(const Device& dev, uint8_t reg_addr) {
-        WriteAddress(MakeAddress(dev.bus, dev.device, dev.function, reg_addr));
-        return ReadData();
+    uint64_t NumConfigReads() {
+        return num_config_reads.load(std::memory_order_relaxed);
     }
 
-    void WriteConfReg(const Device& dev, uint8_t reg_addr, uint32_t value) {
-        WriteAddress(MakeAddress(dev.bus, dev.device, dev.function, reg_addr));
-        WriteData(value);
+    uint32_t ReadConfReg(const Device& dev, uint16_t reg_addr) {
+        return ReadConf32(dev.bus, dev.device, dev.function, reg_addr);
+    }
+
+    void WriteConfReg(const Device& dev, uint16_t reg_addr, uint32_t value) {
+        WriteConf32(dev.bus, dev.device, dev.function, reg_addr, value);
     }
 
-    WithError<uint64_t> ReadBar(Device & device, unsigned int bar_index) {
+    WithError<uint64_t> ReadBar(const Device& device, unsigned int bar_index) {
         if (bar_index >= 6) {
             return {0, MAKE_ERROR(Error::kIndexOutOfRange)};
         }
 
         const auto addr = CalcBarAddress(bar_index);
-        const auto bar = ReadConfReg(device, addr);
+        const auto bar = device.header[addr / 4];
 
         //32 bit address
         if ((bar & 4u) == 0) { 
@@ -178,11 +439,113 @@ namespace pci {
             return {0, MAKE_ERROR(Error::kIndexOutOfRange)};
         }
 
-        const auto bar_upper = ReadConfReg(device, addr + 4); //the unit of addr is 1 byte.
+        const auto bar_upper = device.header[addr / 4 + 1]; //the unit of addr is 1 byte.
         return {
             bar | (static_cast<uint64_t>(bar_upper) << 32),
             MAKE_ERROR(Error::kSuccess)
         };
 
     }
-}
\ No newline at end of file
+
+    CapabilityIterator::CapabilityIterator(const Device& dev, uint8_t offset)
+        : dev_{&dev}, offset_{offset}, remaining_{48}, header_{} { //at most 48 fit in 256 bytes
+        Load();
+    }
+
+    CapabilityIterator& CapabilityIterator::operator++() {
+        offset_ = header_.bits.next_ptr & 0xfcu;
+        Load();
+        return *this;
+    }
+
+    void CapabilityIterator::Load() {
+        if (offset_ == 0) {
+            return;
+        }
+        if (--remaining_ < 0) { //the list loops
+            offset_ = 0;
+            return;
+        }
+        header_.data = ReadConfReg(*dev_, offset_);
+    }
+
+    uint8_t FindCapability(const Device& dev, uint8_t cap_id) {
+        for (auto cap : Capabilities(dev)) {
+            if (cap.header.bits.cap_id == cap_id) {
+                return cap.offset;
+            }
+        }
+        return 0;
+    }
+
+    MSIMessage MakeMSIMessage(uint8_t apic_id, MSITriggerMode trigger_mode,
+                              MSIDeliveryMode delivery_mode, uint8_t vector) {
+        uint32_t data = (static_cast<uint32_t>(delivery_mode) << 8) | vector;
+        if (trigger_mode == MSITriggerMode::kLevel) {
+            data |= 0xc000; //level triggered, assert
+        }
+        return {0xfee00000u | (static_cast<uint32_t>(apic_id) << 12), data};
+    }
+
+    Error ConfigureMSI(const Device& dev, const MSIMessage& msg,
+                       unsigned int num_vector_exponent) {
+        const uint8_t offset = FindCapability(dev, kCapabilityMSI);
+        if (offset == 0) {
+            return MAKE_ERROR(Error::kUnknownDevice);
+        }
+
+        //message control: 0 enable, 3:1 multiple message capable, 6:4 multiple message enable,
+        //7 64 bit address capable
+        uint32_t header = ReadConfReg(dev, offset);
+        uint32_t control = header >> 16;
+        const unsigned int capable = (control >> 1) & 0x7u;
+        const unsigned int enable = num_vector_exponent < capable ? num_vector_exponent : capable;
+        const bool addr64 = control & 0x80u;
+
+        WriteConfReg(dev, offset + 4, msg.address & 0xffffffffu);
+        if (addr64) {
+            WriteConfReg(dev, offset + 8, msg.address >> 32);
+            WriteConfReg(dev, offset + 12, msg.data);
+        } else {
+            WriteConfReg(dev, offset + 8, msg.data);
+        }
+
+        control = (control & ~0x70u) | (enable << 4) | 1u;
+        WriteConfReg(dev, offset, (header & 0xffffu) | (control << 16));
+        return MAKE_ERROR(Error::kSuccess);
+    }
+
+    Error ConfigureMSIX(const Device& dev, unsigned int entry, const MSIMessage& msg) {
+        const uint8_t offset = FindCapability(dev, kCapabilityMSIX);
+        if (offset == 0) {
+            return MAKE_ERROR(Error::kUnknownDevice);
+        }
+
+        //message control: 10:0 table size - 1, 14 function mask, 15 enable
+        const uint32_t header = ReadConfReg(dev, offset);
+        uint32_t control = header >> 16;
+        if (entry > (control & 0x7ffu)) {
+            return MAKE_ERROR(Error::kIndexOutOfRange);
+        }
+
+        //the table is in the memory space of a BAR. bits 2:0 select the BAR.
+        const uint32_t table = ReadConfReg(dev, offset + 4);
+        const auto bar = ReadBar(dev, table & 0x7u);
+        if (bar.error) {
+            return bar.error;
+        }
+        const uint64_t table_addr = (bar.value & ~static_cast<uint64_t>(0xf)) + (table & ~0x7u);
+
+        //an entry is address (low, high), data and vector control. bit 0 of vector control masks it.
+        auto entry_regs = reinterpret_cast<volatile uint32_t*>(table_addr) + 4 * entry;
+        entry_regs[3] = entry_regs[3] | 1u;
+        entry_regs[0] = msg.address & 0xffffffffu;
+        entry_regs[1] = msg.address >> 32;
+        entry_regs[2] = msg.data;
+        entry_regs[3] = entry_regs[3] & ~1u;
+
+        control = (control & ~0x4000u) | 0x8000u;
+        WriteConfReg(dev, offset, (header & 0xffffu) | (control << 16));
+        return MAKE_ERROR(Error::kSuccess);
+    }
+}
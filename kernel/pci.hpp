@@ -6,10 +6,12 @@
 
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <array>
 
 #include "error.hpp"
+#include "acpi.hpp"
 
 namespace pci {
   // #@@range_begin(config_addr)
@@ -34,17 +36,44 @@ namespace pci {
   };
 
 
+  /** @brief コンフィギュレーション空間の標準ヘッダの大きさ（32 ビット単位） */
+  const size_t kConfigHeaderDwords = 16;
+
   /** @brief PCI デバイスを操作するための基礎データを格納する
    *
    * バス番号，デバイス番号，ファンクション番号はデバイスを特定するのに必須．
    * その他の情報は単に利便性のために加えてある．
+   *
+   * header は探索時に読み取った先頭 64 バイトの写しで，ID や BAR の問い合わせは
+   * これで済ませる．コマンドやステータスのように変化するレジスタは ReadConfReg() で読むこと．
    * */
   struct Device {
     uint8_t bus, device, function, header_type;
     ClassCode class_code;
+    uint16_t vendor_id, device_id;
+    std::array<uint32_t, kConfigHeaderDwords> header;
+
+    /** @brief キャパビリティリストの先頭オフセット（リストがなければ 0） */
+    uint8_t CapabilitiesPointer() const {
+      const bool has_list = (header[1] >> 16) & 0x10u; // Status.Capabilities List
+      return has_list ? header[0x34 / 4] & 0xfcu : 0;
+    }
+    /** @brief 割り込みラインレジスタ */
+    uint8_t InterruptLine() const { return header[0x3c / 4] & 0xffu; }
   };
   // #@@range_end(class_code)
 
+  /** @brief MCFG から ECAM 領域を探し，以降のコンフィギュレーション空間アクセスに用いる
+   *
+   * ECAM（Enhanced Configuration Access Mechanism）は 1 回のメモリアクセスで
+   * レジスタを読み書きでき，256 バイト以降の拡張コンフィギュレーション空間にも届く．
+   * mcfg が nullptr か，セグメント 0 のエントリがなければ kUnknownDevice を返し，
+   * 従来通り CONFIG_ADDRESS / CONFIG_DATA の IO ポートを使い続ける．
+   */
+  Error InitializeEcam(const acpi::MCFG* mcfg);
+  /** @brief ECAM が使われている場合に真を返す */
+  bool EcamEnabled();
+
   /** @brief CONFIG_ADDRESS に指定された整数を書き込む */
   void WriteAddress(uint32_t address);
   /** @brief CONFIG_DATA に指定された整数を書き込む */
@@ -61,8 +90,13 @@ namespace pci {
     /** @brief クラスコードレジスタを読み取る（全ヘッダタイプ共通） */
   ClassCode ReadClassCode(uint8_t bus, uint8_t device, uint8_t function);
 
+  /** @brief ベンダ ID を返す（探索時の値．コンフィギュレーション空間は読まない） */
   inline uint16_t ReadVendorId(const Device& dev) {
-    return ReadVendorId(dev.bus,dev.device,dev.function);
+    return dev.vendor_id;
+  }
+  /** @brief クラスコードを返す（探索時の値．コンフィギュレーション空間は読まない） */
+  inline ClassCode ReadClassCode(const Device& dev) {
+    return dev.class_code;
   }
   /** @brief クラスコードレジスタを読み取る（全ヘッダタイプ共通）
    *
@@ -73,10 +107,18 @@ namespace pci {
    *   - 7:0   : リビジョン
    */
   
-  /** @brief 指定された PCI デバイスの 32 ビットレジスタを読み取る */
-  uint32_t ReadConfReg(const Device& dev, uint8_t reg_addr);
+  /** @brief 指定された PCI デバイスの 32 ビットレジスタを読み取る
+   *
+   * reg_addr が 256 以上（拡張コンフィギュレーション空間）の場合，
+   * ECAM が使えなければ 0xffffffff を返す．
+   */
+  uint32_t ReadConfReg(const Device& dev, uint16_t reg_addr);
 
-  void WriteConfReg(const Device& dev, uint8_t reg_addr, uint32_t value);
+  /** @brief 指定された PCI デバイスの 32 ビットレジスタに書き込む
+   *
+   * reg_addr が 256 以上の場合，ECAM が使えなければ何もしない．
+   */
+  void WriteConfReg(const Device& dev, uint16_t reg_addr, uint32_t value);
 
   /** @brief バス番号レジスタを読み取る（ヘッダタイプ 1 用）
    *
@@ -91,23 +133,185 @@ namespace pci {
   bool IsSingleFunctionDevice(uint8_t header_type);
 
   // #@@range_begin(var_devices)
+  /** @brief 発見した PCI デバイスを保持する表
+   *
+   * 要素はチャンク単位で確保されるので，追加しても既存の要素のアドレスは変わらない．
+   * クラスコードとベンダ ID / デバイス ID のそれぞれでハッシュ表を持ち，
+   * 全要素をたどらずに目的のデバイスを探せる．検索結果は追加した順（探索順）に返る．
+   * チャンクはヒープができるまで静的な領域から確保するため，
+   * 保持できるのは kMaxChunks * kChunkSize（1024）個までである．
+   * グローバル変数として使えるよう，ゼロ初期化の状態で空の表として動作する．
+   */
+  class DeviceRegistry {
+   public:
+    static const size_t kChunkSize = 64;
+    static const size_t kMaxChunks = 16;
+    static const size_t kNumBuckets = 64;
+
+    /** @brief 1 チャンク分の要素．next_* は同じバケットの次の要素の番号 + 1（0 なら末尾）． */
+    struct Entry {
+      Device device;
+      uint32_t next_by_class, next_by_id;
+    };
+    using Chunk = std::array<Entry, kChunkSize>;
+
+    /** @brief すべての要素を取り除く．確保済みのチャンクは再利用される． */
+    void Clear();
+    /** @brief デバイスを追加する．チャンクを確保できなければ kFull を返す． */
+    Error Add(const Device& device);
+
+    size_t Size() const { return size_; }
+    Device& operator[](size_t i) { return EntryAt(i).device; }
+    const Device& operator[](size_t i) const { return EntryAt(i).device; }
+
+    /** @brief クラスコードが一致するデバイスを探す
+     *
+     * after を指定すると，after の次に一致するデバイスを返す．見つからなければ nullptr．
+     */
+    Device* FindByClass(uint8_t base, uint8_t sub, uint8_t interface,
+                        const Device* after = nullptr);
+    /** @brief ベンダ ID とデバイス ID が一致するデバイスを探す（after は FindByClass と同じ） */
+    Device* FindById(uint16_t vendor_id, uint16_t device_id,
+                     const Device* after = nullptr);
+
+   private:
+    Entry& EntryAt(size_t i) { return (*chunks_[i / kChunkSize])[i % kChunkSize]; }
+    const Entry& EntryAt(size_t i) const { return (*chunks_[i / kChunkSize])[i % kChunkSize]; }
+
+    std::array<Chunk*, kMaxChunks> chunks_;
+    size_t num_chunks_, size_;
+    //the number of the first / last entry in each bucket + 1. 0 means empty.
+    std::array<uint32_t, kNumBuckets> class_buckets_, id_buckets_;
+    std::array<uint32_t, kNumBuckets> class_tails_, id_tails_;
+  };
+
   /** @brief ScanAllBus() により発見された PCI デバイスの一覧 */
   //pci.hpp is inluded in main.cpp ,too, so if Idon't write inline, it goes against ODR
-  inline std::array<Device, 32> devices; //array:there are 32 Device elements. define global variable in hpp file.
-  /** @brief devices の有効な要素の数 */
-  inline int num_device;
+  inline DeviceRegistry devices;
   /** @brief PCI デバイスをすべて探索し devices に格納する
    *
-   * バス 0 から再帰的に PCI デバイスを探索し，devices の先頭から詰めて書き込む．
-   * 発見したデバイスの数を num_devices に設定する．
+   * ルートバスから幅優先で探索し，devices に追加する．
+   * ECAM が使える場合は MCFG のバス範囲の先頭をルートバスとし，
+   * どのブリッジの範囲にも含まれないバスはデバイス 0 が存在すればルートバスとして探索する．
+   * ECAM が使えない場合はホストブリッジのファンクション番号をルートバスとする．
+   * ブリッジはセカンダリ / サブオーディネイトバス番号が親のバス範囲に収まり，
+   * 他のブリッジの範囲と重ならない場合のみたどる．
+   * 表が一杯になった場合は kFull を返すが，それまでに発見したデバイスは残る．
    */
   Error ScanAllBus();
+
+  /** @brief 起動してからコンフィギュレーション空間を読んだ回数（32 ビット単位） */
+  uint64_t NumConfigReads();
   // #@@range_end(var_devices)
 
   constexpr uint8_t CalcBarAddress(unsigned int bar_index) {
     return 0x10 + 4 * bar_index;
   }
 
-  WithError<uint64_t> ReadBar(Device& device, unsigned int bar_index);
+  /** @brief BAR の値を返す．64 ビット BAR なら次の BAR と合わせた値を返す．
+   *
+   * 探索時に読み取った値を用いる．
+   */
+  WithError<uint64_t> ReadBar(const Device& device, unsigned int bar_index);
+
+  /** @brief キャパビリティ ID */
+  const uint8_t kCapabilityMSI = 0x05;
+  const uint8_t kCapabilityMSIX = 0x11;
+
+  /** @brief キャパビリティレジスタの先頭 32 ビット */
+  union CapabilityHeader {
+    uint32_t data;
+    struct {
+      uint32_t cap_id : 8;
+      uint32_t next_ptr : 8;
+      uint32_t cap : 16;
+    } __attribute__((packed)) bits;
+  } __attribute__((packed));
+
+  /** @brief キャパビリティ 1 つ分．offset はコンフィギュレーション空間内の位置 */
+  struct Capability {
+    uint8_t offset;
+    CapabilityHeader header;
+  };
+
+  /** @brief キャパビリティリストを先頭からたどるイテレータ
+   *
+   * リストが壊れていても止まるよう，たどる数には上限がある．
+   */
+  class CapabilityIterator {
+   public:
+    CapabilityIterator(const Device& dev, uint8_t offset);
+
+    Capability operator*() const { return {offset_, header_}; }
+    CapabilityIterator& operator++();
+    bool operator!=(const CapabilityIterator& rhs) const {
+      return offset_ != rhs.offset_;
+    }
+
+   private:
+    void Load();
+
+    const Device* dev_;
+    uint8_t offset_;
+    int remaining_;
+    CapabilityHeader header_;
+  };
+
+  /** @brief for (auto cap : Capabilities(dev)) の形でキャパビリティをたどるための範囲 */
+  class CapabilityList {
+   public:
+    explicit CapabilityList(const Device& dev) : dev_{dev} {}
+    CapabilityIterator begin() const { return {dev_, dev_.CapabilitiesPointer()}; }
+    CapabilityIterator end() const { return {dev_, 0}; }
+
+   private:
+    const Device& dev_;
+  };
+
+  inline CapabilityList Capabilities(const Device& dev) {
+    return CapabilityList{dev};
+  }
+
+  /** @brief cap_id のキャパビリティの位置を返す．見つからなければ 0 を返す． */
+  uint8_t FindCapability(const Device& dev, uint8_t cap_id);
+
+  /** @brief MSI / MSI-X のメッセージ（書き込み先アドレスと値） */
+  struct MSIMessage {
+    uint64_t address;
+    uint32_t data;
+  };
+
+  enum class MSITriggerMode {
+    kEdge = 0,
+    kLevel = 1
+  };
+
+  enum class MSIDeliveryMode {
+    kFixed          = 0b000,
+    kLowestPriority = 0b001,
+    kSMI            = 0b010,
+    kNMI            = 0b100,
+    kINIT           = 0b101,
+    kExtINT         = 0b111,
+  };
+
+  /** @brief apic_id の Local APIC に vector 番の割り込みを届ける x86 のメッセージを作る */
+  MSIMessage MakeMSIMessage(uint8_t apic_id, MSITriggerMode trigger_mode,
+                            MSIDeliveryMode delivery_mode, uint8_t vector);
+
+  /** @brief MSI を設定して有効にする
+   *
+   * 2^num_vector_exponent 個のベクタを要求するが，デバイスが対応する数で頭打ちになる．
+   * デバイスが MSI キャパビリティを持たなければ kUnknownDevice を返す．
+   */
+  Error ConfigureMSI(const Device& dev, const MSIMessage& msg,
+                     unsigned int num_vector_exponent);
+
+  /** @brief MSI-X テーブルの entry 番目を設定し，MSI-X を有効にする
+   *
+   * テーブルは BAR が指すメモリ空間にあり，アイデンティティマップされている前提．
+   * entry がテーブルの大きさ以上なら kIndexOutOfRange を返す．
+   */
+  Error ConfigureMSIX(const Device& dev, unsigned int entry, const MSIMessage& msg);
 }
 
@@ -0,0 +1,88 @@
+#include "serial.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+#include "asmfunc.h"
+
+namespace {
+  //register offsets from the base port
+  const uint16_t kData = 0;          // THR (write) / RBR (read), divisor low when DLAB = 1
+  const uint16_t kInterruptEnable = 1;  // divisor high when DLAB = 1
+  const uint16_t kFIFOControl = 2;   // FCR (write) / IIR (read)
+  const uint16_t kLineControl = 3;
+  const uint16_t kModemControl = 4;
+  const uint16_t kLineStatus = 5;
+
+  const uint8_t kLineStatusTHREmpty = 1u << 5;
+}
+
+Error SerialPort::Initialize(uint16_t port, uint32_t baud) {
+  port_ = port;
+  read_pos_ = write_pos_ = 0;
+  dropped_ = 0;
+
+  const uint16_t divisor = 115200 / baud;
+  IoOut8(port_ + kInterruptEnable, 0x00);  // we poll, so no interrupts
+  IoOut8(port_ + kLineControl, 0x80);      // DLAB = 1 to set the divisor
+  IoOut8(port_ + kData, divisor & 0xffu);
+  IoOut8(port_ + kInterruptEnable, divisor >> 8);
+  IoOut8(port_ + kLineControl, 0x03);      // 8 bits, no parity, 1 stop bit
+  IoOut8(port_ + kFIFOControl, 0xc7);      // enable and clear FIFO, 14 bytes threshold
+
+  //a byte sent in loopback mode comes back if the UART exists.
+  IoOut8(port_ + kModemControl, 0x1e);
+  IoOut8(port_ + kData, 0xae);
+  if (IoIn8(port_ + kData) != 0xae) {
+    return MAKE_ERROR(Error::kUnknownDevice);
+  }
+  IoOut8(port_ + kModemControl, 0x0f);     // normal operation, DTR, RTS, OUT1, OUT2
+
+  //IIR bits 7:6 are 11 only if the 16 bytes FIFO is working (16550A).
+  fifo_size_ = (IoIn8(port_ + kFIFOControl) & 0xc0u) == 0xc0u ? 16 : 1;
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+void SerialPort::Write(const char* s) {
+  //report what has been dropped once there is room again, as FlushLog() does.
+  if (dropped_ != 0) {
+    char note[64];
+    sprintf(note, "[%lu serial characters dropped]\n", dropped_);
+    if (write_pos_ - read_pos_ + 2 * strlen(note) <= kBufferSize) {
+      dropped_ = 0;
+      Append(note);
+    }
+  }
+  Append(s);
+}
+
+void SerialPort::Append(const char* s) {
+  for (; *s; ++s) {
+    if (write_pos_ - read_pos_ == kBufferSize) {
+      ++dropped_;
+      continue;
+    }
+    if (*s == '\n') { //terminals expect CR LF
+      if (write_pos_ - read_pos_ + 2 > kBufferSize) {
+        ++dropped_;
+        continue;
+      }
+      buffer_[write_pos_++ & (kBufferSize - 1)] = '\r';
+    }
+    buffer_[write_pos_++ & (kBufferSize - 1)] = *s;
+  }
+}
+
+void SerialPort::Flush() {
+  //refill the FIFO as long as the UART keeps up (an emulated one drains at once),
+  //but never wait for it.
+  for (unsigned int n = 0; n < kMaxFifosPerFlush && read_pos_ != write_pos_; ++n) {
+    if ((IoIn8(port_ + kLineStatus) & kLineStatusTHREmpty) == 0) {
+      return;
+    }
+    //THR empty means the whole transmit FIFO is free.
+    for (unsigned int i = 0; i < fifo_size_ && read_pos_ != write_pos_; ++i) {
+      IoOut8(port_ + kData, buffer_[read_pos_++ & (kBufferSize - 1)]);
+    }
+  }
+}
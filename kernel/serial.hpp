@@ -0,0 +1,51 @@
+/**
+ * @file serial.hpp
+ *
+ * UART 16550 互換のシリアルポートへログを出力する機能．
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "error.hpp"
+#include "logger.hpp"
+
+/** @brief UART 16550 を用いたログの出力先．
+ *
+ * Write() は送信バッファに溜めるだけで，ポートには触らない．
+ * Flush() は送信 FIFO が空いている間，FIFO の大きさ分ずつ最大 kMaxFifosPerFlush 回書き込み，
+ * 空いていなければその時点で戻る．1 文字ごとに待つことはない．
+ * 送信バッファが一杯で捨てた文字数は，次に空きができたときにバッファへ書き出す．
+ */
+class SerialPort : public LogSink {
+ public:
+  /** @brief COM1 の IO ポートアドレス */
+  static const uint16_t kCOM1 = 0x3f8;
+  static const size_t kBufferSize = 16 * 1024;  // 2 のべき乗
+  static const unsigned int kMaxFifosPerFlush = 64;
+
+  /** @brief ポートを 8N1, FIFO 有効で初期化する．
+   *
+   * @param port  ベースの IO ポートアドレス
+   * @param baud  ボーレート．115200 の約数であること．
+   * @return ループバックテストに失敗した（ポートが無い）場合は kUnknownDevice
+   */
+  Error Initialize(uint16_t port, uint32_t baud);
+
+  virtual void Write(const char* s) override;
+  virtual void Flush() override;
+
+  /** @brief 送信バッファが一杯で捨て，まだ報告していない文字数 */
+  size_t Dropped() const { return dropped_; }
+
+ private:
+  void Append(const char* s);
+
+  uint16_t port_;
+  unsigned int fifo_size_;  // THR が空のときに続けて書き込めるバイト数
+  char buffer_[kBufferSize];
+  size_t read_pos_, write_pos_;  // リングバッファの読み書き位置（単調増加）
+  size_t dropped_;
+};
@@ -0,0 +1,151 @@
+#include "shadow_buffer.hpp"
+
+#include "blit.hpp"
+
+namespace {
+  //take bytes from the top of the highest free region which is large enough.
+  //the memory below 1 MiB is left alone, and the memory from 4 GiB may not be mapped.
+  //returns 0 if no region is large enough.
+  uintptr_t AllocateFromMemoryMap(const MemoryMap& memory_map, size_t bytes) {
+    const uintptr_t kLowMemoryEnd = 1024 * 1024;
+    const uintptr_t kHighMemoryStart = uintptr_t{1} << 32;
+
+    uintptr_t result = 0;
+    const auto base = reinterpret_cast<uintptr_t>(memory_map.buffer);
+    for (uintptr_t iter = base; iter < base + memory_map.map_size;
+         iter += memory_map.descriptor_size) {
+      auto desc = reinterpret_cast<const MemoryDescriptor*>(iter);
+      if (!(desc->type == MemoryType::kEfiConventionalMemory)) {
+        continue;
+      }
+      uintptr_t start = desc->physical_start;
+      uintptr_t end = start + desc->number_of_pages * kUEFIPageSize;
+      start = start < kLowMemoryEnd ? kLowMemoryEnd : start;
+      end = end > kHighMemoryStart ? kHighMemoryStart : end;
+      if (end <= start || end - start < bytes) {
+        continue;
+      }
+      if (end - bytes > result) {
+        result = end - bytes;
+      }
+    }
+    return result;
+  }
+
+  int Area(const Rectangle<int>& r) {
+    return r.size.x * r.size.y;
+  }
+
+  Rectangle<int> Union(const Rectangle<int>& a, const Rectangle<int>& b) {
+    const int x0 = a.pos.x < b.pos.x ? a.pos.x : b.pos.x;
+    const int y0 = a.pos.y < b.pos.y ? a.pos.y : b.pos.y;
+    const int ax1 = a.pos.x + a.size.x, bx1 = b.pos.x + b.size.x;
+    const int ay1 = a.pos.y + a.size.y, by1 = b.pos.y + b.size.y;
+    const int x1 = ax1 > bx1 ? ax1 : bx1;
+    const int y1 = ay1 > by1 ? ay1 : by1;
+    return {{x0, y0}, {x1 - x0, y1 - y0}};
+  }
+
+  //true if a and b overlap or touch each other.
+  bool Touches(const Rectangle<int>& a, const Rectangle<int>& b) {
+    return a.pos.x <= b.pos.x + b.size.x && b.pos.x <= a.pos.x + a.size.x &&
+           a.pos.y <= b.pos.y + b.size.y && b.pos.y <= a.pos.y + a.size.y;
+  }
+}
+
+void DamageTracker::Add(const Rectangle<int>& rect) {
+  //clip to the screen
+  int x0 = rect.pos.x < 0 ? 0 : rect.pos.x;
+  int y0 = rect.pos.y < 0 ? 0 : rect.pos.y;
+  int x1 = rect.pos.x + rect.size.x > bounds_.x ? bounds_.x : rect.pos.x + rect.size.x;
+  int y1 = rect.pos.y + rect.size.y > bounds_.y ? bounds_.y : rect.pos.y + rect.size.y;
+  if (x0 >= x1 || y0 >= y1) {
+    return;
+  }
+  Rectangle<int> r{{x0, y0}, {x1 - x0, y1 - y0}};
+
+  //merging may make r touch rectangles which we have already checked, so start over.
+  for (int i = 0; i < num_rects_;) {
+    if (Touches(r, rects_[i])) {
+      r = Union(r, rects_[i]);
+      rects_[i] = rects_[--num_rects_];
+      i = 0;
+    } else {
+      ++i;
+    }
+  }
+
+  if (num_rects_ == kMaxRects) {
+    int best = 0, best_growth = -1;
+    for (int i = 0; i < num_rects_; ++i) {
+      int growth = Area(Union(r, rects_[i])) - Area(rects_[i]);
+      if (best_growth < 0 || growth < best_growth) {
+        best = i;
+        best_growth = growth;
+      }
+    }
+    rects_[best] = Union(r, rects_[best]);
+    return;
+  }
+  rects_[num_rects_++] = r;
+}
+
+Error ShadowBuffer::Initialize(const FrameBufferConfig& screen, const MemoryMap& memory_map) {
+  const size_t pixels = static_cast<size_t>(screen.horizontal_resolution) *
+                        screen.vertical_resolution;
+  //whole pages, so the end of the buffer is page aligned like the start.
+  const size_t bytes = (4 * pixels + kUEFIPageSize - 1) & ~static_cast<size_t>(kUEFIPageSize - 1);
+  const uintptr_t buffer = AllocateFromMemoryMap(memory_map, bytes);
+  if (buffer == 0) {
+    return MAKE_ERROR(Error::kNoEnoughMemory);
+  }
+
+  screen_ = &screen;
+  buffer_bytes_ = bytes;
+  shadow_config_ = FrameBufferConfig{
+    reinterpret_cast<uint8_t*>(buffer),
+    screen.horizontal_resolution,  // no padding at the end of each line
+    screen.horizontal_resolution,
+    screen.vertical_resolution,
+    screen.pixel_format,
+  };
+  damage_.SetBounds({static_cast<int>(screen.horizontal_resolution),
+                     static_cast<int>(screen.vertical_resolution)});
+  damage_.Clear();
+  stats_ = Stats{0, 0, 0};
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+void ShadowBuffer::Flush() {
+  if (damage_.NumRects() == 0) {
+    return;
+  }
+
+  const size_t src_pitch = shadow_config_.pixels_per_scan_line;
+  const size_t dst_pitch = screen_->pixels_per_scan_line;
+  auto src_base = reinterpret_cast<const uint32_t*>(shadow_config_.frame_buffer);
+  auto dst_base = reinterpret_cast<uint32_t*>(screen_->frame_buffer);
+
+  uint64_t bytes = 0;
+  for (int i = 0; i < damage_.NumRects(); ++i) {
+    const auto& r = damage_.RectAt(i);
+    const size_t offset_src = src_pitch * r.pos.y + r.pos.x;
+    const size_t offset_dst = dst_pitch * r.pos.y + r.pos.x;
+
+    if (r.size.x == static_cast<int>(src_pitch) && src_pitch == dst_pitch) {
+      //whole lines are contiguous in both buffers, so copy them at once.
+      CopyPixels(dst_base + offset_dst, src_base + offset_src, src_pitch * r.size.y);
+    } else {
+      for (int dy = 0; dy < r.size.y; ++dy) {
+        CopyPixels(dst_base + offset_dst + dst_pitch * dy,
+                   src_base + offset_src + src_pitch * dy, r.size.x);
+      }
+    }
+    bytes += 4 * static_cast<uint64_t>(Area(r));
+  }
+  damage_.Clear();
+
+  stats_.last_flush_bytes = bytes;
+  stats_.total_flush_bytes += bytes;
+  ++stats_.num_flushes;
+}
@@ -0,0 +1,86 @@
+/**
+ * @file shadow_buffer.hpp
+ *
+ * 通常の RAM 上に置く影のフレームバッファと，書き換えられた領域の管理．
+ *
+ * GOP のフレームバッファは VRAM にあり，読み出しや細かい書き込みが遅い．
+ * 描画はすべて影のバッファに対して行い，書き換えられた矩形だけを
+ * まとめて大きな連続コピーで VRAM へ転送する．
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "error.hpp"
+#include "frame_buffer_config.hpp"
+#include "graphics.hpp"
+#include "memory_map.hpp"
+
+/** @brief 書き換えられた矩形領域を記録する．
+ *
+ * 重なる，あるいは接する矩形は 1 つにまとめる．
+ * 記録できる数を超えたら，面積の増加が最も小さい矩形と結合する．
+ */
+class DamageTracker {
+ public:
+  static const int kMaxRects = 16;
+
+  /** @brief 矩形を切り取る範囲（画面の大きさ）を設定する． */
+  void SetBounds(const Vector2D<int>& bounds) { bounds_ = bounds; }
+  /** @brief 書き換えられた矩形を追加する．画面外の部分は切り捨てる． */
+  void Add(const Rectangle<int>& rect);
+  void Clear() { num_rects_ = 0; }
+
+  int NumRects() const { return num_rects_; }
+  const Rectangle<int>& RectAt(int i) const { return rects_[i]; }
+
+ private:
+  Vector2D<int> bounds_{0, 0};
+  std::array<Rectangle<int>, kMaxRects> rects_;
+  int num_rects_ = 0;
+};
+
+/** @brief 影のフレームバッファ．
+ *
+ * Initialize() が成功したら，Config() を使って PixelWriter を作り，
+ * Damage() をその PixelWriter に設定する．
+ * 描画を画面に反映するには Flush() を呼ぶ．
+ */
+class ShadowBuffer {
+ public:
+  struct Stats {
+    uint64_t last_flush_bytes;  // 直近の Flush() で転送したバイト数
+    uint64_t total_flush_bytes;
+    uint64_t num_flushes;
+  };
+
+  /** @brief screen と同じ大きさ，同じピクセル形式の影のバッファを用意する．
+   *
+   * バッファは memory_map の空き領域（EfiConventionalMemory）から取る．
+   * 取った領域は BufferStart() と BufferBytes() で分かるので，他の用途に使わないこと．
+   *
+   * @return 画面全体が入る空き領域がない場合は kNoEnoughMemory
+   */
+  Error Initialize(const FrameBufferConfig& screen, const MemoryMap& memory_map);
+
+  /** @brief 影のバッファを表す設定．PixelWriter の作成に用いる． */
+  const FrameBufferConfig& Config() const { return shadow_config_; }
+  DamageTracker& Damage() { return damage_; }
+
+  /** @brief 書き換えられた矩形を画面のフレームバッファへ転送する． */
+  void Flush();
+
+  const Stats& GetStats() const { return stats_; }
+
+  uintptr_t BufferStart() const { return reinterpret_cast<uintptr_t>(shadow_config_.frame_buffer); }
+  size_t BufferBytes() const { return buffer_bytes_; }
+
+ private:
+  const FrameBufferConfig* screen_;
+  FrameBufferConfig shadow_config_;
+  size_t buffer_bytes_;
+  DamageTracker damage_;
+  Stats stats_;
+};
@@ -0,0 +1,188 @@
+/**
+ * @file test/blit_test.cpp
+ *
+ * blit.cpp の各実装（スカラ，SSE2，AVX2）の出力を参照実装とビット単位で比べるテスト．
+ *
+ * 先頭と末尾がアライメントに揃わない場合や，非テンポラルストアを使う
+ * 4 KiB 以上の領域も試す．書き込み先の前後を書き換えていないことも確かめる．
+ * CPU が対応していない実装は飛ばす．
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "blit.hpp"
+
+namespace {
+  const size_t kGuard = 16;  // pixels before and after the destination which must not change
+  const size_t kMaxOffset = 9;
+
+  // lengths around the vector widths, and around the non-temporal threshold (1024 pixels)
+  std::vector<size_t> TestCounts() {
+    std::vector<size_t> counts;
+    for (size_t n = 0; n <= 80; ++n) {
+      counts.push_back(n);
+    }
+    for (size_t n : {255, 256, 257, 1015, 1016, 1017}) {
+      counts.push_back(n);
+    }
+    for (size_t n = 1020; n <= 1036; ++n) {
+      counts.push_back(n);
+    }
+    for (size_t n : {4093, 4096, 4099, 1920 * 16 + 5}) {
+      counts.push_back(n);
+    }
+    return counts;
+  }
+
+  uint32_t rand_state = 2463534242u;
+  uint32_t Random() {
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 17;
+    rand_state ^= rand_state << 5;
+    return rand_state;
+  }
+
+  void FillRandom(uint32_t* p, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+      p[i] = Random();
+    }
+  }
+
+  // mostly 0 or 0xffffffff as sprites use, with some arbitrary bits
+  void FillRandomMask(uint32_t* p, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+      const uint32_t r = Random();
+      p[i] = (r & 7) == 0 ? Random() : (r & 8) ? 0xffffffffu : 0;
+    }
+  }
+
+  uint32_t SwapRB(uint32_t v) {
+    return (v & 0xff00ff00u) | ((v & 0xffu) << 16) | ((v >> 16) & 0xffu);
+  }
+
+  uint32_t* AllocPixels(size_t count) {
+    // 64-byte aligned so that the offsets decide the alignment of the head
+    const size_t size = (count * sizeof(uint32_t) + 63) & ~size_t{63};
+    return static_cast<uint32_t*>(aligned_alloc(64, size));
+  }
+
+  const char* BlitImplName(BlitImpl impl) {
+    switch (impl) {
+      case kBlitScalar: return "scalar";
+      case kBlitSSE2: return "SSE2";
+      case kBlitAVX2: return "AVX2";
+    }
+    return "?";
+  }
+
+  int num_checks, num_failures;
+
+  void Check(bool ok, const char* impl, const char* op, size_t count,
+             size_t dst_offset, size_t src_offset) {
+    ++num_checks;
+    if (!ok) {
+      ++num_failures;
+      if (num_failures <= 20) {
+        printf("FAIL %s %s: count %zu, dst offset %zu, src offset %zu\n",
+               impl, op, count, dst_offset, src_offset);
+      }
+    }
+  }
+
+  void TestImpl(const char* impl) {
+    const auto counts = TestCounts();
+    const size_t max_count = counts.back();
+    const size_t buf_len = kGuard + kMaxOffset + max_count + kGuard;
+    uint32_t* const dst = AllocPixels(buf_len);
+    uint32_t* const expected = AllocPixels(buf_len);
+    uint32_t* const src = AllocPixels(kMaxOffset + max_count);
+    uint32_t* const mask = AllocPixels(kMaxOffset + max_count);
+
+    for (size_t count : counts) {
+      const size_t len = kGuard + kMaxOffset + count + kGuard;
+      for (size_t d = 0; d < kMaxOffset; ++d) {
+        uint32_t* const out = dst + kGuard + d;
+        uint32_t* const exp = expected + kGuard + d;
+
+        FillRandom(dst, len);
+        memcpy(expected, dst, len * sizeof(uint32_t));
+        const uint32_t value = Random();
+        FillPixels(out, value, count);
+        for (size_t i = 0; i < count; ++i) {
+          exp[i] = value;
+        }
+        Check(memcmp(dst, expected, len * sizeof(uint32_t)) == 0,
+              impl, "FillPixels", count, d, 0);
+
+        for (size_t s = 0; s < kMaxOffset; ++s) {
+          const uint32_t* const in = src + s;
+          const uint32_t* const m = mask + s;
+          FillRandom(src, s + count);
+          FillRandomMask(mask, s + count);
+
+          FillRandom(dst, len);
+          memcpy(expected, dst, len * sizeof(uint32_t));
+          CopyPixels(out, in, count);
+          memcpy(exp, in, count * sizeof(uint32_t));
+          Check(memcmp(dst, expected, len * sizeof(uint32_t)) == 0,
+                impl, "CopyPixels", count, d, s);
+
+          FillRandom(dst, len);
+          memcpy(expected, dst, len * sizeof(uint32_t));
+          CopyPixelsMasked(out, in, m, count);
+          for (size_t i = 0; i < count; ++i) {
+            exp[i] = (in[i] & m[i]) | (exp[i] & ~m[i]);
+          }
+          Check(memcmp(dst, expected, len * sizeof(uint32_t)) == 0,
+                impl, "CopyPixelsMasked", count, d, s);
+
+          FillRandom(dst, len);
+          memcpy(expected, dst, len * sizeof(uint32_t));
+          CopyPixelsSwapRB(out, in, count);
+          for (size_t i = 0; i < count; ++i) {
+            exp[i] = SwapRB(in[i]);
+          }
+          Check(memcmp(dst, expected, len * sizeof(uint32_t)) == 0,
+                impl, "CopyPixelsSwapRB", count, d, s);
+        }
+
+        // scrolling copies within one buffer with dst < src
+        for (size_t shift = 1; shift < kMaxOffset; ++shift) {
+          if (count + shift > max_count) {
+            continue;
+          }
+          FillRandom(dst, len + shift);
+          memcpy(expected, dst, (len + shift) * sizeof(uint32_t));
+          CopyPixels(out, out + shift, count);
+          memmove(exp, exp + shift, count * sizeof(uint32_t));
+          Check(memcmp(dst, expected, (len + shift) * sizeof(uint32_t)) == 0,
+                impl, "CopyPixels (overlap)", count, d, d + shift);
+        }
+      }
+    }
+
+    free(mask);
+    free(src);
+    free(expected);
+    free(dst);
+  }
+}
+
+int main() {
+  for (auto impl : {kBlitScalar, kBlitSSE2, kBlitAVX2}) {
+    const char* name = BlitImplName(impl);
+    if (!SelectBlitImpl(impl)) {
+      printf("%s: not supported by this CPU, skipped\n", name);
+      continue;
+    }
+    const int failures = num_failures;
+    TestImpl(name);
+    printf("%s: %s\n", name, num_failures == failures ? "ok" : "FAILED");
+  }
+
+  printf("%d checks, %d failures\n", num_checks, num_failures);
+  return num_failures == 0 ? 0 : 1;
+}
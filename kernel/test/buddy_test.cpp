@@ -0,0 +1,257 @@
+/**
+ * @file test/buddy_test.cpp
+ *
+ * usb::BuddyAllocator と usb::AllocMem() のテスト．
+ *
+ * ホストのメモリを物理メモリに見立てて，ランダムな確保と解放を繰り返し，
+ * アライメント，境界（boundary）を跨がないこと，確保した領域同士が重ならないこと，
+ * 解放後にブロックが結合されて元に戻ることを確かめる．
+ */
+
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "memory_map.hpp"
+#include "usb/buddy.hpp"
+#include "usb/memory.hpp"
+
+namespace {
+  int num_checks, num_failures;
+
+#define CHECK(cond, ...) \
+  do { \
+    ++num_checks; \
+    if (!(cond)) { \
+      ++num_failures; \
+      if (num_failures <= 20) { \
+        printf("FAIL %s:%d: %s: ", __FILE__, __LINE__, #cond); \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+      } \
+    } \
+  } while (0)
+
+  uint32_t rand_state = 2463534242u;
+  uint32_t Random() {
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 17;
+    rand_state ^= rand_state << 5;
+    return rand_state;
+  }
+
+  size_t CeilPow2(size_t value) {
+    size_t n = 1;
+    while (n < value) {
+      n <<= 1;
+    }
+    return n;
+  }
+
+  bool Crosses(uintptr_t addr, size_t size, size_t boundary) {
+    return boundary != 0 && size > 0 &&
+           (addr / boundary) != ((addr + size - 1) / boundary);
+  }
+
+  // host memory below 4 GiB which stands in for physical memory
+  uintptr_t MapLowMemory(size_t bytes) {
+    void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+    return p == MAP_FAILED ? 0 : reinterpret_cast<uintptr_t>(p);
+  }
+
+  struct Block {
+    uintptr_t addr;
+    size_t size;
+    uint8_t pattern;
+  };
+
+  // every live block keeps its own byte pattern. an overlap destroys the pattern of another block.
+  void FillPattern(const Block& b) {
+    memset(reinterpret_cast<void*>(b.addr), b.pattern, b.size);
+  }
+
+  bool PatternIntact(const Block& b) {
+    auto p = reinterpret_cast<const uint8_t*>(b.addr);
+    for (size_t i = 0; i < b.size; ++i) {
+      if (p[i] != b.pattern) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  usb::BuddyAllocator buddy;  // zero-initialised, as in the kernel
+
+  void TestBuddyAllocator() {
+    using usb::BuddyAllocator;
+    const size_t kMaxBlock = size_t{1} << BuddyAllocator::kMaxOrder;
+    const size_t kArenaBytes = 8 * kMaxBlock;
+    const uintptr_t arena = MapLowMemory(kArenaBytes + kMaxBlock);
+    CHECK(arena != 0, "mmap failed");
+    if (arena == 0) {
+      return;
+    }
+
+    // start a page past a 1 MiB boundary and end short of a page, so that the edges are cut
+    const uintptr_t aligned = (arena + kMaxBlock - 1) & ~(kMaxBlock - 1);
+    const uintptr_t start = aligned + 4096 - 100;
+    const size_t bytes = kArenaBytes - 4096 - 200;
+    const size_t added = buddy.AddRegion(start, bytes);
+    CHECK(added == kArenaBytes - 2 * 4096, "added %zu", added);
+    CHECK(buddy.TotalBytes() == added && buddy.FreeBytes() == added,
+          "total %zu, free %zu", buddy.TotalBytes(), buddy.FreeBytes());
+    const uintptr_t region_start = aligned + 4096, region_end = region_start + added;
+
+    CHECK(buddy.Allocate(kMaxBlock + 1, 0) == nullptr, "larger than the largest block");
+    CHECK(!buddy.Free(reinterpret_cast<void*>(region_start)), "free of a free block");
+    int outside;
+    CHECK(!buddy.Free(&outside), "free of memory out of the regions");
+
+    std::vector<Block> live;
+    size_t live_bytes = 0;
+    for (int i = 0; i < 50000; ++i) {
+      if (live.empty() || Random() % 100 < 55) {
+        // sizes are mostly small, sometimes up to the largest block
+        const size_t size = Random() % 8 == 0 ? 1 + Random() % kMaxBlock
+                                              : 1 + Random() % (64 * 1024);
+        const size_t alignment = size_t{1} << (Random() % 18);
+        void* p = buddy.Allocate(size, alignment);
+        if (p == nullptr) {
+          continue;  // running out is fine
+        }
+        const auto addr = reinterpret_cast<uintptr_t>(p);
+        const size_t block_size = CeilPow2(std::max<size_t>({size, alignment, 4096}));
+        CHECK(region_start <= addr && addr + block_size <= region_end,
+              "block 0x%lx+%zu out of the region", addr, block_size);
+        CHECK(addr % alignment == 0, "0x%lx not aligned to %zu", addr, alignment);
+        CHECK(addr % block_size == 0, "0x%lx not aligned to its size %zu", addr, block_size);
+        if (size <= 64 * 1024) {
+          CHECK(!Crosses(addr, size, 64 * 1024), "0x%lx+%zu crosses 64 KiB", addr, size);
+        }
+        CHECK(buddy.Owns(p), "0x%lx not owned", addr);
+
+        live.push_back({addr, block_size, static_cast<uint8_t>(Random())});
+        FillPattern(live.back());
+        live_bytes += block_size;
+      } else {
+        const size_t index = Random() % live.size();
+        const Block b = live[index];
+        CHECK(PatternIntact(b), "block 0x%lx+%zu overwritten", b.addr, b.size);
+        if (b.size > 4096) {
+          CHECK(!buddy.Free(reinterpret_cast<void*>(b.addr + 4096)),
+                "free of the middle of a block");
+        }
+        CHECK(buddy.Free(reinterpret_cast<void*>(b.addr)), "free 0x%lx", b.addr);
+        live[index] = live.back();
+        live.pop_back();
+        live_bytes -= b.size;
+      }
+      CHECK(buddy.FreeBytes() + live_bytes == buddy.TotalBytes(),
+            "free %zu + live %zu != total %zu", buddy.FreeBytes(), live_bytes, buddy.TotalBytes());
+    }
+
+    for (const auto& b : live) {
+      CHECK(PatternIntact(b), "block 0x%lx+%zu overwritten", b.addr, b.size);
+      CHECK(buddy.Free(reinterpret_cast<void*>(b.addr)), "free 0x%lx", b.addr);
+    }
+    CHECK(buddy.FreeBytes() == buddy.TotalBytes(), "free %zu", buddy.FreeBytes());
+
+    // everything has merged back: all 1 MiB-aligned 1 MiB blocks of the region are available
+    const size_t num_max_blocks = (region_end & ~(kMaxBlock - 1)) / kMaxBlock -
+                                  (region_start + kMaxBlock - 1) / kMaxBlock;
+    std::vector<void*> max_blocks;
+    while (void* p = buddy.Allocate(kMaxBlock, 0)) {
+      max_blocks.push_back(p);
+    }
+    CHECK(max_blocks.size() == num_max_blocks,
+          "%zu of %zu max blocks after merging", max_blocks.size(), num_max_blocks);
+    for (void* p : max_blocks) {
+      buddy.Free(p);
+    }
+    CHECK(buddy.FreeBytes() == buddy.TotalBytes(), "free %zu", buddy.FreeBytes());
+  }
+
+  void TestAllocMem() {
+    const size_t kRegionBytes = 4 * 1024 * 1024;
+    const uintptr_t memory = MapLowMemory(3 * kRegionBytes);
+    CHECK(memory != 0, "mmap failed");
+    if (memory == 0) {
+      return;
+    }
+
+    // conventional memory with a reserved hole (e.g. the shadow buffer),
+    // then memory which must not be used at all
+    const uintptr_t reserved_start = memory + kRegionBytes / 2;
+    const size_t reserved_bytes = 256 * 1024;
+    const uintptr_t unusable = memory + kRegionBytes;
+    MemoryDescriptor descs[2]{};
+    descs[0].type = static_cast<uint32_t>(MemoryType::kEfiConventionalMemory);
+    descs[0].physical_start = memory;
+    descs[0].number_of_pages = kRegionBytes / kUEFIPageSize;
+    descs[1].type = static_cast<uint32_t>(MemoryType::kEfiBootServicesData);
+    descs[1].physical_start = unusable;
+    descs[1].number_of_pages = kRegionBytes / kUEFIPageSize;
+    MemoryMap memory_map{sizeof(descs), descs, sizeof(descs), 0, sizeof(MemoryDescriptor), 1};
+
+    const size_t added = usb::AddFreeMemory(memory_map, reserved_start, reserved_bytes);
+    CHECK(added == kRegionBytes - reserved_bytes, "added %zu", added);
+
+    std::vector<Block> live;
+    for (int i = 0; i < 20000; ++i) {
+      if (live.empty() || Random() % 100 < 55) {
+        const size_t size = Random() % 4 == 0 ? 1 + Random() % (256 * 1024)
+                                              : 1 + Random() % 2048;
+        const unsigned int alignment = Random() % 4 == 0 ? 0 : 1u << (Random() % 13);
+        const unsigned int boundary = Random() % 3 == 0 ? 0 : 4096u << (Random() % 5);
+        void* p = usb::AllocMem(size, alignment, boundary);
+        if (p == nullptr) {
+          continue;
+        }
+        const auto addr = reinterpret_cast<uintptr_t>(p);
+        if (alignment) {
+          CHECK(addr % alignment == 0, "0x%lx not aligned to %u", addr, alignment);
+        }
+        if (size <= boundary) {
+          CHECK(!Crosses(addr, size, boundary),
+                "0x%lx+%zu crosses %u", addr, size, boundary);
+        }
+        CHECK(addr + size <= reserved_start || reserved_start + reserved_bytes <= addr,
+              "0x%lx+%zu in the reserved range", addr, size);
+        CHECK(addr + size <= unusable || unusable + kRegionBytes <= addr,
+              "0x%lx+%zu in boot services data", addr, size);
+
+        live.push_back({addr, size, static_cast<uint8_t>(Random())});
+        FillPattern(live.back());
+      } else {
+        const size_t index = Random() % live.size();
+        const Block b = live[index];
+        CHECK(PatternIntact(b), "buffer 0x%lx+%zu overwritten", b.addr, b.size);
+        usb::FreeMem(reinterpret_cast<void*>(b.addr));
+        live[index] = live.back();
+        live.pop_back();
+      }
+    }
+
+    for (const auto& b : live) {
+      CHECK(PatternIntact(b), "buffer 0x%lx+%zu overwritten", b.addr, b.size);
+      usb::FreeMem(reinterpret_cast<void*>(b.addr));
+    }
+    const auto stats = usb::GetMemoryStats();
+    CHECK(stats.used_bytes == 0, "used %zu", stats.used_bytes);
+    CHECK(stats.free_pages == stats.total_pages, "free pages %zu", stats.free_pages);
+    CHECK(stats.dma_free_bytes == stats.dma_total_bytes, "dma free %zu", stats.dma_free_bytes);
+    CHECK(stats.num_allocs == stats.num_frees,
+          "%zu allocs, %zu frees", stats.num_allocs, stats.num_frees);
+  }
+}
+
+int main() {
+  TestBuddyAllocator();
+  TestAllocMem();
+  printf("%d checks, %d failures\n", num_checks, num_failures);
+  return num_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,111 @@
+/**
+ * @file test/fill_bench.cpp
+ *
+ * 画面全体の塗りつぶしにかかる時間を測るベンチマーク．
+ *
+ * 偽の FrameBufferConfig でホストのメモリに描画するので，起動せずに計測できる．
+ * 1 ピクセルごとに仮想関数 Write を呼ぶ以前の FillRectangle と，
+ * パック済みの値をスパン単位で書き込む現在の FillRectangle を比べる．
+ *
+ * 使い方: fill_bench [width height [iterations]]
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include "frame_buffer_config.hpp"
+#include "graphics.hpp"
+#include "blit.hpp"
+
+namespace {
+  // FillRectangle before the span API: one virtual call per pixel.
+  __attribute__((noinline))
+  void FillRectanglePerPixel(PixelWriter& writer, const Vector2D<int>& pos,
+                             const Vector2D<int>& size, const PixelColor& c) {
+    for (int dy = 0; dy < size.y; ++dy) {
+      for (int dx = 0; dx < size.x; ++dx) {
+        writer.Write(pos.x + dx, pos.y + dy, c);
+      }
+    }
+  }
+
+  template <class Func>
+  void Measure(const char* name, const FrameBufferConfig& config, int iterations, Func fill) {
+    const PixelColor colors[2] = {{45, 118, 237}, {0, 0, 0}};
+    fill(colors[1]);  // touch every page before measuring
+
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+      fill(colors[i & 1]);
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    const double pixels = double(config.horizontal_resolution) * config.vertical_resolution;
+    const double sec_per_fill = elapsed.count() / iterations;
+    printf("%-28s %9.3f ms/fill %9.1f Mpixel/s %7.2f GB/s\n",
+           name, sec_per_fill * 1e3, pixels / sec_per_fill / 1e6,
+           pixels * 4 / sec_per_fill / 1e9);
+  }
+
+  const char* BlitImplName(BlitImpl impl) {
+    switch (impl) {
+      case kBlitScalar: return "scalar";
+      case kBlitSSE2: return "SSE2";
+      case kBlitAVX2: return "AVX2";
+    }
+    return "?";
+  }
+}
+
+int main(int argc, char** argv) {
+  int width = 1920, height = 1080, iterations = 50;
+  if (argc >= 3) {
+    width = atoi(argv[1]);
+    height = atoi(argv[2]);
+  }
+  if (argc >= 4) {
+    iterations = atoi(argv[3]);
+  }
+  if (width <= 0 || height <= 0 || iterations <= 0) {
+    fprintf(stderr, "usage: %s [width height [iterations]]\n", argv[0]);
+    return 1;
+  }
+
+  // the pitch is the width rounded up to 8 pixels, as GOP modes usually are.
+  const uint32_t pitch = (width + 7) & ~7u;
+  const size_t buf_size = (size_t{4} * pitch * height + 4095) & ~size_t{4095};
+  auto buf = static_cast<uint8_t*>(aligned_alloc(4096, buf_size));
+  if (buf == nullptr) {
+    fprintf(stderr, "failed to allocate the frame buffer\n");
+    return 1;
+  }
+  const FrameBufferConfig config{
+    buf, pitch, static_cast<uint32_t>(width), static_cast<uint32_t>(height),
+    kPixelBGRResv8BitPerColor
+  };
+  BGRResv8BitPerColorPixelWriter bgr_writer{config};
+  PixelWriter& writer = bgr_writer;
+
+  printf("%dx%d (pitch %u), %d iterations\n", width, height, pitch, iterations);
+
+  const Vector2D<int> pos{0, 0}, size{width, height};
+  Measure("per-pixel virtual Write", config, iterations, [&](const PixelColor& c) {
+    FillRectanglePerPixel(writer, pos, size, c);
+  });
+
+  // the scalar implementation is used until InitializeBlit() is called.
+  Measure("FillRectangle (scalar)", config, iterations, [&](const PixelColor& c) {
+    FillRectangle(writer, pos, size, c);
+  });
+
+  InitializeBlit();
+  char name[64];
+  snprintf(name, sizeof(name), "FillRectangle (%s)", BlitImplName(CurrentBlitImpl()));
+  Measure(name, config, iterations, [&](const PixelColor& c) {
+    FillRectangle(writer, pos, size, c);
+  });
+
+  free(buf);
+  return 0;
+}
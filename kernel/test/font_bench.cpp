@@ -0,0 +1,101 @@
+/**
+ * @file test/font_bench.cpp
+ *
+ * 文字の描画速度（文字/秒）を測るベンチマーク．
+ *
+ * グリフのビットを 1 つずつ調べて仮想関数 Write で書く以前の WriteAscii と，
+ * パック済みのピクセル列をキャッシュから行ごとにコピーする WriteAscii(fg, bg) を比べる．
+ * 偽の FrameBufferConfig でホストのメモリに描画する．
+ *
+ * 使い方: font_bench [num_chars]
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include "frame_buffer_config.hpp"
+#include "graphics.hpp"
+#include "font.hpp"
+#include "blit.hpp"
+
+const uint8_t* GetFont(char c);  // font.cpp
+
+namespace {
+  const int kWidth = 1024, kHeight = 768;
+  const int kColumns = kWidth / 8, kRows = kHeight / 16;
+
+  // WriteAscii before the glyph cache: tests all 128 bits and calls Write for each set one.
+  __attribute__((noinline))
+  void WriteAsciiPerBit(PixelWriter& writer, int x, int y, char c, const PixelColor& color) {
+    const uint8_t* font = GetFont(c);
+    if (font == nullptr) {
+      return;
+    }
+    for (int dy = 0; dy < 16; ++dy) {
+      for (int dx = 0; dx < 8; ++dx) {
+        if ((font[dy] << dx) & 0x80u) {
+          writer.Write(x + dx, y + dy, color);
+        }
+      }
+    }
+  }
+
+  // draw num_chars printable characters over the screen, cell by cell
+  template <class Func>
+  void Measure(const char* name, long num_chars, Func write) {
+    const auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < num_chars; ++i) {
+      const int cell = i % (kColumns * kRows);
+      write(8 * (cell % kColumns), 16 * (cell / kColumns), static_cast<char>(' ' + i % 95));
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    printf("%-36s %8.2f Mchar/s %8.1f ns/char\n",
+           name, num_chars / elapsed.count() / 1e6, elapsed.count() / num_chars * 1e9);
+  }
+}
+
+int main(int argc, char** argv) {
+  long num_chars = 2000000;
+  if (argc >= 2) {
+    num_chars = atol(argv[1]);
+  }
+  if (num_chars <= 0) {
+    fprintf(stderr, "usage: %s [num_chars]\n", argv[0]);
+    return 1;
+  }
+
+  auto buf = static_cast<uint8_t*>(aligned_alloc(4096, 4 * kWidth * kHeight));
+  if (buf == nullptr) {
+    fprintf(stderr, "failed to allocate the frame buffer\n");
+    return 1;
+  }
+  const FrameBufferConfig config{
+    buf, kWidth, kWidth, kHeight, kPixelBGRResv8BitPerColor
+  };
+  BGRResv8BitPerColorPixelWriter bgr_writer{config};
+  PixelWriter& writer = bgr_writer;
+  InitializeBlit();
+
+  const PixelColor fg{255, 255, 255}, bg{45, 118, 237};
+  FillRectangle(writer, {0, 0}, {kWidth, kHeight}, bg);
+  printf("%dx%d, %ld characters\n", kWidth, kHeight, num_chars);
+
+  Measure("per-bit WriteAscii (virtual Write)", num_chars, [&](int x, int y, char c) {
+    WriteAsciiPerBit(writer, x, y, c, fg);
+  });
+  // the per-bit version doesn't draw the background, so an opaque cell needs a fill first
+  Measure("  + FillRectangle of the cell", num_chars, [&](int x, int y, char c) {
+    FillRectangle(writer, {x, y}, {8, 16}, bg);
+    WriteAsciiPerBit(writer, x, y, c, fg);
+  });
+  Measure("per-bit WriteAscii(fg)", num_chars, [&](int x, int y, char c) {
+    WriteAscii(writer, x, y, c, fg);
+  });
+  Measure("cached-row WriteAscii(fg, bg)", num_chars, [&](int x, int y, char c) {
+    WriteAscii(writer, x, y, c, fg, bg);
+  });
+
+  free(buf);
+  return 0;
+}
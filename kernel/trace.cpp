@@ -0,0 +1,16 @@
+#include "trace.hpp"
+
+#include <cstring>
+
+namespace trace {
+  void Initialize() {
+    for (int i = 0; i < kNumCategories; ++i) {
+      Ring& ring = rings[i];
+      memcpy(ring.magic, "MKTRACE", 8);
+      ring.version = 1;
+      ring.category = i;
+      ring.capacity = Ring::kCapacity;
+    }
+    enabled_categories = (1u << kNumCategories) - 1;
+  }
+}
@@ -0,0 +1,106 @@
+/**
+ * @file trace.hpp
+ *
+ * 固定長のバイナリレコードによる軽量なトレース機能．
+ *
+ * 書式化を行わず，タイムスタンプ，イベント ID，整数引数だけを
+ * カテゴリごとのリングバッファに記録する．
+ * リングはメモリダンプから tools/tracedump.py で読める形式になっている．
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace trace {
+  /** @brief トレースのカテゴリ．カテゴリごとに別のリングに記録される． */
+  enum Category {
+    kGeneral,
+    kUSB,
+    kPCI,
+    kNumCategories,  // この列挙子は常に最後に配置する
+  };
+
+  /** @brief イベント ID．
+   *
+   * tools/tracedump.py はこの列挙型を読んでイベント名を表示する．
+   * 既存の値は変更せず，追加は末尾に行う．
+   */
+  enum Event : uint16_t {
+    kNone = 0,
+    kXHCPortStatusChange = 1,  // port_id, completion_code
+    kXHCTransferEvent = 2,  // slot_id, endpoint_id, completion_code, length, trb
+    kXHCCommandCompletion = 3,  // slot_id, issuer_type, completion_code, trb
+    kXHCResetPort = 4,  // port_id, is_connected
+    kXHCEnableSlot = 5,  // port_id, is_enabled, reset_completed
+    kXHCAddressDevice = 6,  // port_id, slot_id
+    kXHCInitializeDevice = 7,  // port_id, slot_id
+    kXHCCompleteConfiguration = 8,  // port_id, slot_id
+    kXHCEventError = 9,  // error code, line
+  };
+
+  const uint32_t kNumArgs = 5;
+
+  /** @brief 1 件のトレースレコード（32 バイト） */
+  struct Entry {
+    uint64_t tsc;
+    uint16_t event;
+    uint16_t num_args;
+    uint32_t args[kNumArgs];
+  };
+  static_assert(sizeof(Entry) == 32);
+
+  /** @brief 1 カテゴリ分のリング．ダンプの形式そのものなので，メンバの配置を変えない． */
+  struct Ring {
+    static const uint32_t kCapacity = 1024;  // 2 のべき乗
+
+    char magic[8];  // "MKTRACE"
+    uint16_t version;
+    uint16_t category;
+    uint32_t capacity;
+    std::atomic<uint64_t> head;  // これまでに記録したレコードの総数
+    uint64_t reserved;
+    Entry entries[kCapacity];
+  };
+  static_assert((Ring::kCapacity & (Ring::kCapacity - 1)) == 0);
+
+  inline Ring rings[kNumCategories];
+  /** @brief 記録を有効にするカテゴリのビットマスク */
+  inline uint32_t enabled_categories;
+
+  /** @brief リングのヘッダを書き込み，全カテゴリの記録を有効にする． */
+  void Initialize();
+
+  inline uint64_t ReadTSC() {
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return (static_cast<uint64_t>(hi) << 32) | lo;
+  }
+
+  /** @brief イベントを記録する．
+   *
+   * 書式化は行わない．リングが一杯なら最も古いレコードを上書きする．
+   * 引数は 5 個まで，それぞれ 32 ビットに切り詰めて記録する．
+   */
+  template <typename... Args>
+  inline void Record(Category category, Event event, Args... args) {
+    static_assert(sizeof...(Args) <= kNumArgs, "too many trace arguments");
+    if ((enabled_categories & (1u << category)) == 0) {
+      return;
+    }
+
+    Ring& ring = rings[category];
+    const uint64_t i = ring.head.fetch_add(1, std::memory_order_relaxed);
+    Entry& r = ring.entries[i & (Ring::kCapacity - 1)];
+    r.tsc = ReadTSC();
+    r.event = event;
+    r.num_args = sizeof...(Args);
+    uint32_t values[kNumArgs] = {static_cast<uint32_t>(args)...};
+    for (uint32_t j = 0; j < kNumArgs; ++j) {
+      r.args[j] = values[j];
+    }
+  }
+}
+
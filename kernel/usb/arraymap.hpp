@@ -7,41 +7,118 @@
 #pragma once
 
 #include <array>
+#include <cstdint>
+#include <cstring>
 #include <optional>
+#include <type_traits>
+
+#include "error.hpp"
 
 namespace usb {
+  /** @brief 最大 N 個の要素を持つ固定容量のハッシュマップ
+   *
+   * オープンアドレス法（線形探索）で，表の大きさは 2N 以上の 2 のべき乗とする．
+   * 削除時は後続の要素を詰め直す（backward shift）ので，墓標が溜まって探索が遅くなることはない．
+   * キーはバイト列としてハッシュするので，パディングを含まない 8 バイト以下の型に限る．
+   */
   template <class K, class V, size_t N = 16>
   class ArrayMap {
+    static_assert(std::is_trivially_copyable_v<K> && sizeof(K) <= 8,
+                  "K must be a plain value of at most 8 bytes");
+
    public:
-     std::optional<V> Get(const K& key) const {
-      for (int i = 0; i < table_.size(); ++i) {
-        if (auto opt_k = table_[i].first; opt_k && opt_k.value() == key) {
-          return table_[i].second;
+    std::optional<V> Get(const K& key) const {
+      for (size_t i = Home(key); table_[i].used; i = Next(i)) {
+        if (table_[i].key == key) {
+          return table_[i].value;
         }
       }
       return std::nullopt;
     }
 
-    void Put(const K& key, const V& value) {
-      for (int i = 0; i < table_.size(); ++i) {
-        if (!table_[i].first) {
-          table_[i].first = key;
-          table_[i].second = value;
-          break;
+    /** @brief 要素を追加する．同じキーがあれば値を置き換える．
+     *
+     * 既に N 個の要素があり追加できない場合は kFull を返す．
+     */
+    Error Put(const K& key, const V& value) {
+      size_t i = Home(key);
+      for (; table_[i].used; i = Next(i)) {
+        if (table_[i].key == key) {
+          table_[i].value = value;
+          return MAKE_ERROR(Error::kSuccess);
         }
       }
+      if (size_ == N) {
+        return MAKE_ERROR(Error::kFull);
+      }
+      table_[i] = {true, key, value};
+      ++size_;
+      return MAKE_ERROR(Error::kSuccess);
     }
 
     void Delete(const K& key) {
-      for (int i = 0; i < table_.size(); ++i) {
-        if (auto opt_k = table_[i].first; opt_k && opt_k.value() == key) {
-          table_[i].first = std::nullopt;
+      size_t hole = Home(key);
+      for (; table_[hole].used; hole = Next(hole)) {
+        if (table_[hole].key == key) {
           break;
         }
       }
+      if (!table_[hole].used) {
+        return;
+      }
+
+      // move back the following entries which can't be found past the hole any more
+      for (size_t i = Next(hole); table_[i].used; i = Next(i)) {
+        const size_t home = Home(table_[i].key);
+        if (((i - home) & kMask) >= ((i - hole) & kMask)) {
+          table_[hole] = table_[i];
+          hole = i;
+        }
+      }
+      table_[hole].used = false;
+      --size_;
     }
 
+    size_t Size() const { return size_; }
+    static constexpr size_t Capacity() { return N; }
+
    private:
-    std::array<std::pair<std::optional<K>, V>, N> table_{};
+    static constexpr size_t CalcTableSize() {
+      size_t n = 1;
+      while (n < 2 * N) {
+        n <<= 1;
+      }
+      return n;
+    }
+    static constexpr size_t kTableSize = CalcTableSize();
+    static constexpr size_t kMask = kTableSize - 1;
+
+    static constexpr int CalcTableBits() {
+      int bits = 0;
+      while ((size_t{1} << bits) < kTableSize) {
+        ++bits;
+      }
+      return bits;
+    }
+    static constexpr int kTableBits = CalcTableBits();
+
+    static size_t Home(const K& key) {
+      uint64_t bits = 0;
+      memcpy(&bits, &key, sizeof(K));
+      // Fibonacci hashing. the upper bits are mixed well even if the lower ones are all zero
+      // (e.g. aligned pointers).
+      return (bits * 0x9e3779b97f4a7c15u) >> (64 - kTableBits);
+    }
+
+    static size_t Next(size_t i) { return (i + 1) & kMask; }
+
+    struct Entry {
+      bool used;
+      K key;
+      V value;
+    };
+
+    std::array<Entry, kTableSize> table_{};
+    size_t size_ = 0;
   };
 }
@@ -0,0 +1,147 @@
+#include "usb/buddy.hpp"
+
+namespace {
+  const uintptr_t kPageMask = (uintptr_t{1} << usb::BuddyAllocator::kMinOrder) - 1;
+
+  // the smallest order whose block holds bytes
+  int OrderOf(size_t bytes) {
+    int order = 0;
+    while ((size_t{1} << order) < bytes) {
+      ++order;
+    }
+    return order;
+  }
+}
+
+namespace usb {
+  size_t BuddyAllocator::AddRegion(uintptr_t start, size_t bytes) {
+    uintptr_t end = (start + bytes) & ~kPageMask;
+    start = (start + kPageMask) & ~kPageMask;
+    if (start >= end || num_regions_ == kMaxRegions || num_pages_ == kMaxPages) {
+      return 0;
+    }
+    if (((end - start) >> kMinOrder) > kMaxPages - num_pages_) {
+      end = start + ((kMaxPages - num_pages_) << kMinOrder);
+    }
+
+    auto& region = regions_[num_regions_++];
+    region = {start, end, num_pages_};
+    const size_t pages = (end - start) >> kMinOrder;
+    num_pages_ += pages;
+
+    // cut the region into the largest blocks which are aligned to their size
+    for (uintptr_t addr = start; addr < end; ) {
+      int order = kMaxOrder;
+      while (order > kMinOrder &&
+             ((addr & ((uintptr_t{1} << order) - 1)) != 0 ||
+              addr + (uintptr_t{1} << order) > end)) {
+        --order;
+      }
+      PushFree(region, addr, order);
+      addr += uintptr_t{1} << order;
+    }
+    return end - start;
+  }
+
+  void* BuddyAllocator::Allocate(size_t size, size_t alignment) {
+    int order = OrderOf(size);
+    if (order < OrderOf(alignment)) {
+      order = OrderOf(alignment);
+    }
+    if (order < kMinOrder) {
+      order = kMinOrder;
+    }
+    if (order > kMaxOrder) {
+      return nullptr;
+    }
+
+    int found = order;
+    while (found <= kMaxOrder && free_lists_[found - kMinOrder] == nullptr) {
+      ++found;
+    }
+    if (found > kMaxOrder) {
+      return nullptr;
+    }
+
+    const auto addr = reinterpret_cast<uintptr_t>(free_lists_[found - kMinOrder]);
+    const auto& region = regions_[FindRegion(addr)];
+    RemoveFree(region, addr, found);
+    // split it, giving the upper halves back
+    while (found > order) {
+      --found;
+      PushFree(region, addr + (uintptr_t{1} << found), found);
+    }
+
+    PageState(region, addr) = order - kMinOrder + 1;
+    return reinterpret_cast<void*>(addr);
+  }
+
+  bool BuddyAllocator::Free(void* p) {
+    auto addr = reinterpret_cast<uintptr_t>(p);
+    const int region_index = FindRegion(addr);
+    if (region_index < 0) {
+      return false;
+    }
+    const auto& region = regions_[region_index];
+    const uint8_t state = PageState(region, addr);
+    if (state == 0 || (state & kFreeBit)) {  // not the head of an allocated block
+      return false;
+    }
+
+    int order = state + kMinOrder - 1;
+    PageState(region, addr) = 0;
+
+    // merge with the buddy as long as it's free and has the same order
+    while (order < kMaxOrder) {
+      const uintptr_t buddy = addr ^ (uintptr_t{1} << order);
+      if (buddy < region.start || region.end < buddy + (uintptr_t{1} << order)) {
+        break;
+      }
+      if (PageState(region, buddy) != (kFreeBit | (order - kMinOrder + 1))) {
+        break;
+      }
+      RemoveFree(region, buddy, order);
+      addr = addr < buddy ? addr : buddy;
+      ++order;
+    }
+    PushFree(region, addr, order);
+    return true;
+  }
+
+  int BuddyAllocator::FindRegion(uintptr_t addr) const {
+    for (int i = 0; i < num_regions_; ++i) {
+      if (regions_[i].start <= addr && addr < regions_[i].end) {
+        return i;
+      }
+    }
+    return -1;
+  }
+
+  // free_pages_ is counted only by these two
+  void BuddyAllocator::PushFree(const Region& region, uintptr_t addr, int order) {
+    auto block = reinterpret_cast<FreeBlock*>(addr);
+    auto& head = free_lists_[order - kMinOrder];
+    block->prev = nullptr;
+    block->next = head;
+    if (head) {
+      head->prev = block;
+    }
+    head = block;
+    PageState(region, addr) = kFreeBit | (order - kMinOrder + 1);
+    free_pages_ += size_t{1} << (order - kMinOrder);
+  }
+
+  void BuddyAllocator::RemoveFree(const Region& region, uintptr_t addr, int order) {
+    auto block = reinterpret_cast<FreeBlock*>(addr);
+    if (block->prev) {
+      block->prev->next = block->next;
+    } else {
+      free_lists_[order - kMinOrder] = block->next;
+    }
+    if (block->next) {
+      block->next->prev = block->prev;
+    }
+    PageState(region, addr) = 0;
+    free_pages_ -= size_t{1} << (order - kMinOrder);
+  }
+}
@@ -0,0 +1,74 @@
+/**
+ * @file usb/buddy.hpp
+ *
+ * 物理的に連続した DMA 用メモリを確保するバディアロケータ
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace usb {
+  /** @brief 2^order バイトのブロックを単位とするバディアロケータ
+   *
+   * 2^order バイトのブロックは 2^order に揃っているので，
+   * 2^order 以上の 2 のべき乗の境界（64 KiB 境界など）を跨がない．
+   * 管理する領域はアイデンティティマップされている前提で，空きブロック自身にリストを置く．
+   * ゼロ初期化の状態で空のアロケータとして動作する．
+   */
+  class BuddyAllocator {
+   public:
+    static const int kMinOrder = 12;  // 4 KiB
+    static const int kMaxOrder = 20;  // 1 MiB
+    /** @brief 管理できる最大のページ（2^kMinOrder バイト）数 */
+    static const size_t kMaxPages = 8192;
+    static const int kMaxRegions = 16;
+
+    /** @brief [start, start + bytes) を空きメモリとして加える
+     *
+     * ページ境界に揃わない端は捨てる．管理できるページ数や領域数を超える分も捨てる．
+     * @return 実際に加えたバイト数
+     */
+    size_t AddRegion(uintptr_t start, size_t bytes);
+
+    /** @brief size バイト以上，alignment に揃ったブロックを確保する．できなければ nullptr． */
+    void* Allocate(size_t size, size_t alignment);
+    /** @brief Allocate() で確保したブロックを解放する．このアロケータのものでなければ false． */
+    bool Free(void* p);
+    /** @brief p がこのアロケータの管理する領域内なら真 */
+    bool Owns(const void* p) const { return FindRegion(reinterpret_cast<uintptr_t>(p)) >= 0; }
+
+    size_t TotalBytes() const { return num_pages_ << kMinOrder; }
+    size_t FreeBytes() const { return free_pages_ << kMinOrder; }
+
+   private:
+    static const int kNumOrders = kMaxOrder - kMinOrder + 1;
+    // page_state_ of the first page of a block: order - kMinOrder + 1, plus kFreeBit if it's free.
+    // 0 for the other pages.
+    static const uint8_t kFreeBit = 0x80;
+
+    struct Region {
+      uintptr_t start, end;
+      size_t first_page;  // index of its first page in page_state_
+    };
+
+    struct FreeBlock {
+      FreeBlock* next;
+      FreeBlock* prev;
+    };
+
+    int FindRegion(uintptr_t addr) const;
+    uint8_t& PageState(const Region& region, uintptr_t addr) {
+      return page_state_[region.first_page + ((addr - region.start) >> kMinOrder)];
+    }
+    void PushFree(const Region& region, uintptr_t addr, int order);
+    void RemoveFree(const Region& region, uintptr_t addr, int order);
+
+    FreeBlock* free_lists_[kNumOrders];
+    uint8_t page_state_[kMaxPages];
+    Region regions_[kMaxRegions];
+    int num_regions_;
+    size_t num_pages_, free_pages_;
+  };
+}
@@ -1,9 +1,13 @@
 #include "usb/classdriver/keyboard.hpp"
 
 #include <algorithm>
-#include "usb/memory.hpp"
+#include "usb/object_pool.hpp"
 #include "usb/device.hpp"
 
+namespace {
+  usb::ObjectPool<usb::HIDKeyboardDriver, 8> driver_pool;
+}
+
 namespace usb {
   HIDKeyboardDriver::HIDKeyboardDriver(Device* dev, int interface_index)
       : HIDBaseDriver{dev, interface_index, 8} {
@@ -24,12 +28,12 @@ namespace usb {
     return MAKE_ERROR(Error::kSuccess);
   }
 
-  void* HIDKeyboardDriver::operator new(size_t size) {
-    return AllocMem(sizeof(HIDKeyboardDriver), 0, 0);
+  void* HIDKeyboardDriver::operator new(size_t size) noexcept {
+    return driver_pool.Allocate();
   }
 
   void HIDKeyboardDriver::operator delete(void* ptr) noexcept {
-    FreeMem(ptr);
+    driver_pool.Free(ptr);
   }
 
   void HIDKeyboardDriver::SubscribeKeyPush(
@@ -14,7 +14,7 @@ namespace usb {
    public:
     HIDKeyboardDriver(Device* dev, int interface_index);
 
-    void* operator new(size_t size);
+    void* operator new(size_t size) noexcept;
     void operator delete(void* ptr) noexcept;
 
     Error OnDataReceived() override;
@@ -1,10 +1,14 @@
 #include "usb/classdriver/mouse.hpp"
 
 #include <algorithm>
-#include "usb/memory.hpp"
+#include "usb/object_pool.hpp"
 #include "usb/device.hpp"
 #include "logger.hpp"
 
+namespace {
+  usb::ObjectPool<usb::HIDMouseDriver, 8> driver_pool;
+}
+
 namespace usb {
   HIDMouseDriver::HIDMouseDriver(Device* dev, int interface_index)
       : HIDBaseDriver{dev, interface_index, 3} {
@@ -14,16 +18,16 @@ namespace usb {
     int8_t displacement_x = Buffer()[1];
     int8_t displacement_y = Buffer()[2];
     NotifyMouseMove(displacement_x, displacement_y);
-    Log(kDebug, "%02x,(%3d,%3d)\n", Buffer()[0], displacement_x, displacement_y);
+    LOG(kDebug, "%02x,(%3d,%3d)\n", Buffer()[0], displacement_x, displacement_y);
     return MAKE_ERROR(Error::kSuccess);
   }
 
-  void* HIDMouseDriver::operator new(size_t size) {
-    return AllocMem(sizeof(HIDMouseDriver), 0, 0);
+  void* HIDMouseDriver::operator new(size_t size) noexcept {
+    return driver_pool.Allocate();
   }
 
   void HIDMouseDriver::operator delete(void* ptr) noexcept {
-    FreeMem(ptr);
+    driver_pool.Free(ptr);
   }
 
   void HIDMouseDriver::SubscribeMouseMove(
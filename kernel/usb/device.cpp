@@ -58,12 +58,20 @@ namespace {
         if_desc.interface_sub_class == 1) {  // HID boot interface
       if (if_desc.interface_protocol == 1) {  // keyboard
         auto keyboard_driver = new usb::HIDKeyboardDriver{dev, if_desc.interface_number};
+        if (keyboard_driver == nullptr) {
+          LOG(kError, "no free HID keyboard driver\n");
+          return nullptr;
+        }
         if (usb::HIDKeyboardDriver::default_observer) {
           keyboard_driver->SubscribeKeyPush(usb::HIDKeyboardDriver::default_observer);
         }
         return keyboard_driver;
       } else if (if_desc.interface_protocol == 2) {  // mouse
         auto mouse_driver = new usb::HIDMouseDriver{dev, if_desc.interface_number};
+        if (mouse_driver == nullptr) {
+          LOG(kError, "no free HID mouse driver\n");
+          return nullptr;
+        }
         if (usb::HIDMouseDriver::default_observer) {
           mouse_driver->SubscribeMouseMove(usb::HIDMouseDriver::default_observer);
         }
@@ -107,7 +115,9 @@ namespace usb {
   Error Device::ControlIn(EndpointID ep_id, SetupData setup_data,
                           void* buf, int len, ClassDriver* issuer) {
     if (issuer) {
-      event_waiters_.Put(setup_data, issuer);
+      if (auto err = event_waiters_.Put(setup_data, issuer)) {
+        return err;
+      }
     }
     return MAKE_ERROR(Error::kSuccess);
   }
@@ -115,7 +125,9 @@ namespace usb {
   Error Device::ControlOut(EndpointID ep_id, SetupData setup_data,
                            const void* buf, int len, ClassDriver* issuer) {
     if (issuer) {
-      event_waiters_.Put(setup_data, issuer);
+      if (auto err = event_waiters_.Put(setup_data, issuer)) {
+        return err;
+      }
     }
     return MAKE_ERROR(Error::kSuccess);
   }
@@ -148,7 +160,7 @@ namespace usb {
 
   Error Device::OnControlCompleted(EndpointID ep_id, SetupData setup_data,
                                    const void* buf, int len) {
-    Log(kDebug, "Device::OnControlCompleted: buf 0x%08x, len %d, dir %d\n",
+    LOG(kDebug, "Device::OnControlCompleted: buf 0x%08x, len %d, dir %d\n",
         buf, len, setup_data.request_type.bits.direction);
     if (is_initialized_) {
       if (auto w = event_waiters_.Get(setup_data)) {
@@ -181,7 +193,7 @@ namespace usb {
   }
 
   Error Device::OnInterruptCompleted(EndpointID ep_id, const void* buf, int len) {
-    Log(kDebug, "Device::OnInterruptCompleted: ep addr %d\n", ep_id.Address());
+    LOG(kDebug, "Device::OnInterruptCompleted: ep addr %d\n", ep_id.Address());
     if (auto w = class_drivers_[ep_id.Number()]) {
       return w->OnInterruptCompleted(ep_id, buf, len);
     }
@@ -193,7 +205,7 @@ namespace usb {
     num_configurations_ = device_desc->num_configurations;
     config_index_ = 0;
     initialize_phase_ = 2;
-    Log(kDebug, "issuing GetDesc(Config): index=%d)\n", config_index_);
+    LOG(kDebug, "issuing GetDesc(Config): index=%d)\n", config_index_);
     return GetDescriptor(*this, kDefaultControlPipeID,
                          ConfigurationDescriptor::kType, config_index_,
                          buf_.data(), buf_.size(), true);
@@ -208,7 +220,7 @@ namespace usb {
 
     ClassDriver* class_driver = nullptr;
     while (auto if_desc = config_reader.Next<InterfaceDescriptor>()) {
-      Log(kDebug, *if_desc);
+      LOG(kDebug, *if_desc);
 
       class_driver = NewClassDriver(this, *if_desc);
       if (class_driver == nullptr) {
@@ -222,13 +234,13 @@ namespace usb {
         auto desc = config_reader.Next();
         if (auto ep_desc = DescriptorDynamicCast<EndpointDescriptor>(desc)) {
           auto conf = MakeEPConfig(*ep_desc);
-          Log(kDebug, conf);
+          LOG(kDebug, conf);
 
           ep_configs_[num_ep_configs_] = conf;
           ++num_ep_configs_;
           class_drivers_[conf.ep_id.Number()] = class_driver;
         } else if (auto hid_desc = DescriptorDynamicCast<HIDDescriptor>(desc)) {
-          Log(kDebug, *hid_desc);
+          LOG(kDebug, *hid_desc);
         }
       }
 
@@ -239,7 +251,7 @@ namespace usb {
       return MAKE_ERROR(Error::kSuccess);
     }
     initialize_phase_ = 3;
-    Log(kDebug, "issuing SetConfiguration: conf_val=%d\n",
+    LOG(kDebug, "issuing SetConfiguration: conf_val=%d\n",
         conf_desc->configuration_value);
     return SetConfiguration(*this, kDefaultControlPipeID,
                             conf_desc->configuration_value, true);
@@ -1,5 +1,8 @@
 #include "usb/memory.hpp"
 
+#include "usb/buddy.hpp"
+
+#include <algorithm>
 #include <cstdint>
 
 namespace {
@@ -12,32 +15,284 @@ namespace {
   T MaskBits(T value, U mask) {
     return value & ~static_cast<T>(mask - 1);
   }
+
+  // the smallest power of 2 which is >= value
+  size_t CeilPow2(size_t value) {
+    size_t n = 1;
+    while (n < value) {
+      n <<= 1;
+    }
+    return n;
+  }
 }
 
 namespace usb {
-  alignas(64) uint8_t memory_pool[kMemoryPoolSize];
-  uintptr_t alloc_ptr = reinterpret_cast<uintptr_t>(memory_pool);
+  alignas(kPageSize) uint8_t memory_pool[kMemoryPoolSize];
+
+  namespace {
+    const size_t kNumPages = kMemoryPoolSize / kPageSize;
+    const size_t kMinBlockSize = 64;
+    // 7 classes: 64, 128, ..., 4096 bytes
+    const int kNumSizeClasses = 7;
+    static_assert((kMinBlockSize << (kNumSizeClasses - 1)) == kPageSize);
+
+    enum class PageState : uint8_t {
+      kFree,
+      kSlab,     // split into blocks of class_index
+      kRunHead,  // the first page of an allocation of run_pages pages
+      kRunBody,  // the rest of such an allocation
+    };
+
+    // the page map. a page whose PageInfo is all zero is free,
+    // so the allocator works before any constructor runs.
+    struct PageInfo {
+      PageState state;
+      uint8_t class_index;
+      uint16_t used_blocks;  // kSlab only
+      uint16_t run_pages;    // kRunHead only
+      // list of the slab pages of the same class which have free blocks.
+      // page number + 1, 0 terminates.
+      uint16_t prev_partial, next_partial;
+      void* free_list;       // free blocks in this page
+    };
+
+    PageInfo pages[kNumPages];
+    uint16_t partial_pages[kNumSizeClasses];  // head of the lists above
+    size_t used_pages;
+    BuddyAllocator dma_memory;  // memory from the UEFI memory map
+    MemoryStats stats;  // total_pages and free_pages are filled by GetMemoryStats()
+
+    size_t BlockSize(int class_index) {
+      return kMinBlockSize << class_index;
+    }
+
+    uint8_t* PageAddr(size_t page) {
+      return memory_pool + page * kPageSize;
+    }
+
+    void PushPartial(size_t page) {
+      auto& info = pages[page];
+      auto& head = partial_pages[info.class_index];
+      info.prev_partial = 0;
+      info.next_partial = head;
+      if (head) {
+        pages[head - 1].prev_partial = page + 1;
+      }
+      head = page + 1;
+    }
+
+    void RemovePartial(size_t page) {
+      auto& info = pages[page];
+      if (info.prev_partial) {
+        pages[info.prev_partial - 1].next_partial = info.next_partial;
+      } else {
+        partial_pages[info.class_index] = info.next_partial;
+      }
+      if (info.next_partial) {
+        pages[info.next_partial - 1].prev_partial = info.prev_partial;
+      }
+      info.prev_partial = info.next_partial = 0;
+    }
+
+    // find num_pages free pages in a row which start at a multiple of alignment and,
+    // if boundary > 0, don't cross it. returns kNumPages if there is none.
+    size_t FindFreeRun(size_t num_pages, size_t alignment, size_t boundary) {
+      for (size_t start = 0; start + num_pages <= kNumPages; ++start) {
+        const auto first = reinterpret_cast<uintptr_t>(PageAddr(start));
+        const auto last = first + num_pages * kPageSize - 1;
+        if (alignment > 0 && first % alignment != 0) {
+          continue;
+        }
+        if (boundary > 0 && first / boundary != last / boundary) {
+          continue;
+        }
+        size_t n = 0;
+        while (n < num_pages && pages[start + n].state == PageState::kFree) {
+          ++n;
+        }
+        if (n == num_pages) {
+          return start;
+        }
+      }
+      return kNumPages;
+    }
+
+    void* AllocPages(size_t size, size_t alignment, size_t boundary) {
+      const size_t num_pages = Ceil(size, kPageSize) / kPageSize;
+      // the boundary doesn't matter if size > boundary
+      const size_t start = FindFreeRun(num_pages, alignment, boundary >= size ? boundary : 0);
+      if (start == kNumPages) {
+        return nullptr;
+      }
+
+      pages[start].state = PageState::kRunHead;
+      pages[start].run_pages = num_pages;
+      for (size_t i = 1; i < num_pages; ++i) {
+        pages[start + i].state = PageState::kRunBody;
+      }
+      used_pages += num_pages;
+      stats.used_bytes += num_pages * kPageSize;
+      return PageAddr(start);
+    }
+
+    void* AllocBlock(int class_index) {
+      if (partial_pages[class_index] == 0) {
+        const size_t page = FindFreeRun(1, 0, 0);
+        if (page == kNumPages) {
+          return nullptr;
+        }
+
+        // split the page into blocks and chain them in address order
+        auto& info = pages[page];
+        info = PageInfo{PageState::kSlab, static_cast<uint8_t>(class_index)};
+        const size_t block_size = BlockSize(class_index);
+        for (size_t offset = kPageSize; offset > 0; offset -= block_size) {
+          auto block = PageAddr(page) + offset - block_size;
+          *reinterpret_cast<void**>(block) = info.free_list;
+          info.free_list = block;
+        }
+        PushPartial(page);
+        ++used_pages;
+      }
+
+      const size_t page = partial_pages[class_index] - 1;
+      auto& info = pages[page];
+      void* block = info.free_list;
+      info.free_list = *reinterpret_cast<void**>(block);
+      ++info.used_blocks;
+      if (info.free_list == nullptr) {
+        RemovePartial(page);
+      }
+      stats.used_bytes += BlockSize(class_index);
+      return block;
+    }
+
+    void FreeBlock(size_t page, void* p) {
+      auto& info = pages[page];
+      const size_t block_size = BlockSize(info.class_index);
+      p = PageAddr(page) + MaskBits(reinterpret_cast<uint8_t*>(p) - PageAddr(page), block_size);
+
+      if (info.free_list == nullptr) {
+        PushPartial(page);
+      }
+      *reinterpret_cast<void**>(p) = info.free_list;
+      info.free_list = p;
+      --info.used_blocks;
+      stats.used_bytes -= block_size;
+
+      // give an empty page back so that other classes and large allocations can use it
+      if (info.used_blocks == 0) {
+        RemovePartial(page);
+        info = PageInfo{};
+        --used_pages;
+      }
+    }
+  }
 
   void* AllocMem(size_t size, unsigned int alignment, unsigned int boundary) {
-    if (alignment > 0) {
-      alloc_ptr = Ceil(alloc_ptr, alignment);
+    // a block of size S is aligned to S, so it never crosses a power-of-2 boundary >= S.
+    // if boundary < S but size <= boundary, the first size bytes don't cross it either.
+    const size_t block_size = CeilPow2(std::max<size_t>(
+          {size, static_cast<size_t>(alignment), kMinBlockSize}));
+
+    void* p = nullptr;
+    if (size >= kPageSize) {
+      // the same argument holds for buddy blocks, which are aligned to their size.
+      p = dma_memory.Allocate(size, alignment);
     }
-    if (boundary > 0) {
-      auto next_boundary = Ceil(alloc_ptr, boundary);
-      if (next_boundary < alloc_ptr + size) {
-        alloc_ptr = next_boundary;
+    if (p == nullptr && block_size <= kPageSize) {
+      int class_index = 0;
+      while (BlockSize(class_index) < block_size) {
+        ++class_index;
       }
+      p = AllocBlock(class_index);
+    } else if (p == nullptr) {
+      p = AllocPages(size, alignment, boundary);
     }
 
-    if (reinterpret_cast<uintptr_t>(memory_pool) + kMemoryPoolSize
-        < alloc_ptr + size) {
-      return nullptr;
+    if (p) {
+      ++stats.num_allocs;
+      if (stats.used_bytes > stats.peak_used_bytes) {
+        stats.peak_used_bytes = stats.used_bytes;
+      }
+    } else {
+      ++stats.num_failed_allocs;
     }
+    return p;
+  }
 
-    auto p = alloc_ptr;
-    alloc_ptr += size;
-    return reinterpret_cast<void*>(p);
+  void FreeMem(void* p) {
+    auto addr = reinterpret_cast<uint8_t*>(p);
+    if (addr < memory_pool || memory_pool + kMemoryPoolSize <= addr) {
+      if (dma_memory.Free(p)) {
+        ++stats.num_frees;
+      }
+      return;  // nullptr or not ours
+    }
+
+    const size_t page = (addr - memory_pool) / kPageSize;
+    auto& info = pages[page];
+    switch (info.state) {
+    case PageState::kSlab:
+      FreeBlock(page, p);
+      break;
+    case PageState::kRunHead:
+      used_pages -= info.run_pages;
+      stats.used_bytes -= info.run_pages * kPageSize;
+      for (size_t i = info.run_pages; i > 0; --i) {
+        pages[page + i - 1] = PageInfo{};
+      }
+      break;
+    default:  // not allocated, or the middle of a large allocation
+      return;
+    }
+    ++stats.num_frees;
   }
 
-  void FreeMem(void* p) {}
+  MemoryStats GetMemoryStats() {
+    auto s = stats;
+    s.total_pages = kNumPages;
+    s.free_pages = kNumPages - used_pages;
+    s.dma_total_bytes = dma_memory.TotalBytes();
+    s.dma_free_bytes = dma_memory.FreeBytes();
+    return s;
+  }
+
+  size_t AddFreeMemory(const MemoryMap& memory_map,
+                       uintptr_t reserved_start, size_t reserved_bytes) {
+    const uintptr_t kLowMemoryEnd = 1024 * 1024;  // leave the legacy area alone
+    // the buffers are handed to the xHC, which may support only 32-bit addresses (AC64 = 0)
+    const uintptr_t kDMAMemoryEnd = uintptr_t{1} << 32;
+
+    size_t added = 0;
+    const auto base = reinterpret_cast<uintptr_t>(memory_map.buffer);
+    for (uintptr_t iter = base; iter < base + memory_map.map_size;
+         iter += memory_map.descriptor_size) {
+      auto desc = reinterpret_cast<const MemoryDescriptor*>(iter);
+      if (!(desc->type == MemoryType::kEfiConventionalMemory)) {
+        continue;
+      }
+      uintptr_t start = desc->physical_start;
+      uintptr_t end = start + desc->number_of_pages * kUEFIPageSize;
+      start = std::max(start, kLowMemoryEnd);
+      end = std::min(end, kDMAMemoryEnd);
+      if (end <= start) {
+        continue;
+      }
+
+      const uintptr_t reserved_end = reserved_start + reserved_bytes;
+      if (reserved_bytes == 0 || reserved_end <= start || end <= reserved_start) {
+        added += dma_memory.AddRegion(start, end - start);
+        continue;
+      }
+      // register the parts before and after the reserved range
+      if (start < reserved_start) {
+        added += dma_memory.AddRegion(start, reserved_start - start);
+      }
+      if (reserved_end < end) {
+        added += dma_memory.AddRegion(reserved_end, end - reserved_end);
+      }
+    }
+    return added;
+  }
 }
@@ -8,9 +8,13 @@
 
 #include <cstddef>
 
+#include "memory_map.hpp"
+
 namespace usb {
   /** @brief 動的メモリ確保のためのメモリプールの最大容量（バイト） */
   static const size_t kMemoryPoolSize = 4096 * 32;
+  /** @brief メモリプールを管理する単位（バイト） */
+  static const size_t kPageSize = 4096;
 
   /** @brief 指定されたバイト数のメモリ領域を確保して先頭ポインタを返す．
    *
@@ -18,6 +22,11 @@ namespace usb {
    * size <= boundary ならメモリ領域が boundary を跨がないことを保証する．
    * boundary は典型的にはページ境界を跨がないように 4096 を指定する．
    *
+   * 4096 バイト未満の要求は 64 バイトから 4096 バイトまでの 2 のべき乗のサイズクラスで確保する．
+   * 4096 バイト以上の要求は AddFreeMemory() で登録したメモリからバディアロケータで確保し，
+   * そこで確保できなければメモリプールの連続したページで確保する．
+   * alignment と boundary は 2 のべき乗でなければならない．
+   *
    * @param size        確保するメモリ領域のサイズ（バイト単位）
    * @param alignment   メモリ領域のアライメント制約．0 なら制約しない．
    * @param boundary    確保したメモリ領域が跨いではいけない境界．0 なら制約しない．
@@ -31,9 +40,33 @@ namespace usb {
         AllocMem(sizeof(T) * num_obj, alignment, boundary));
   }
 
-  /** @brief 指定されたメモリ領域を解放する．本当に解放することは保証されない． */
+  /** @brief AllocMem() で確保したメモリ領域を解放する．nullptr なら何もしない． */
   void FreeMem(void* p);
 
+  /** @brief UEFI メモリマップの空き領域（EfiConventionalMemory）を大きな確保用に登録する
+   *
+   * 1 MiB 未満の領域は使わない．登録できる量には上限がある（BuddyAllocator::kMaxPages）．
+   * 64 ビットアドレスに対応しない（HCCPARAMS1.AC64 = 0）xHC でも使えるよう，4 GiB 以上の領域も使わない．
+   *
+   * @param reserved_start  既に他の用途（影のフレームバッファなど）に使っている領域の先頭．この領域は登録しない．
+   * @param reserved_bytes  その領域の大きさ．0 なら除く領域はない．
+   * @return 登録したバイト数
+   */
+  size_t AddFreeMemory(const MemoryMap& memory_map,
+                       uintptr_t reserved_start, size_t reserved_bytes);
+
+  /** @brief メモリプールの使用状況 */
+  struct MemoryStats {
+    size_t total_pages, free_pages;  // プール全体のページ数と，どこにも使われていないページ数
+    size_t used_bytes;               // 確保済みのブロックの合計（サイズクラスに切り上げた大きさ）
+    size_t peak_used_bytes;          // used_bytes の最大値
+    size_t num_allocs, num_frees, num_failed_allocs;
+    size_t dma_total_bytes, dma_free_bytes;  // AddFreeMemory() で登録した領域
+  };
+
+  /** @brief メモリプールの使用状況を返す */
+  MemoryStats GetMemoryStats();
+
   /** @brief 標準コンテナ用のメモリアロケータ */
   template <class T, unsigned int Alignment = 64, unsigned int Boundary = 4096>
   class Allocator {
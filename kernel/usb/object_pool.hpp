@@ -0,0 +1,84 @@
+/**
+ * @file usb/object_pool.hpp
+ *
+ * 型ごとの固定容量オブジェクトプール．
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+
+namespace usb {
+  /** @brief 型 T のオブジェクトを最大 N 個保持するプール
+   *
+   * 確保も解放も空きリストの操作だけで済み（O(1)），断片化しない．
+   * 各スロットは Alignment バイト（既定はキャッシュライン）に揃っている．
+   * ゼロ初期化の状態で空のプールとして動作するので，グローバル変数として置ける．
+   */
+  template <class T, size_t N, size_t Alignment = 64>
+  class ObjectPool {
+   public:
+    /** @brief 未構築のスロットを 1 つ取り出す．空きがなければ nullptr． */
+    void* Allocate() {
+      if (free_list_) {
+        auto slot = free_list_;
+        free_list_ = slot->next;
+        ++num_used_;
+        return slot->storage;
+      }
+      if (num_touched_ < N) {  // slots which have never been used
+        ++num_used_;
+        return slots_[num_touched_++].storage;
+      }
+      return nullptr;
+    }
+
+    /** @brief Allocate() で取り出したスロットを返却する．nullptr なら何もしない． */
+    void Free(void* p) {
+      if (p == nullptr) {
+        return;
+      }
+      auto slot = reinterpret_cast<Slot*>(p);
+      slot->next = free_list_;
+      free_list_ = slot;
+      --num_used_;
+    }
+
+    /** @brief スロットを取り出して T を構築する．空きがなければ nullptr． */
+    template <class... Args>
+    T* New(Args&&... args) {
+      void* p = Allocate();
+      return p ? new(p) T(std::forward<Args>(args)...) : nullptr;
+    }
+
+    /** @brief New() で構築したオブジェクトを破棄して返却する */
+    void Delete(T* obj) {
+      if (obj) {
+        obj->~T();
+        Free(obj);
+      }
+    }
+
+    bool Owns(const void* p) const {
+      auto addr = reinterpret_cast<uintptr_t>(p);
+      auto begin = reinterpret_cast<uintptr_t>(slots_);
+      return begin <= addr && addr < begin + sizeof(slots_);
+    }
+
+    size_t NumUsed() const { return num_used_; }
+    static constexpr size_t Capacity() { return N; }
+
+   private:
+    union alignas(Alignment) Slot {
+      Slot* next;  // valid while the slot is free
+      alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+    Slot slots_[N];
+    Slot* free_list_;
+    size_t num_touched_, num_used_;
+  };
+}
@@ -2,11 +2,15 @@
 
 #include "logger.hpp"
 #include "usb/memory.hpp"
+#include "usb/object_pool.hpp"
 #include "usb/xhci/ring.hpp"
 
 namespace {
   using namespace usb::xhci;
 
+  // transfer rings of all devices. a device with a few endpoints needs 2 or 3.
+  usb::ObjectPool<Ring, 32> ring_pool;
+
   SetupStageTRB MakeSetupStageTRB(usb::SetupData setup_data, int transfer_type) {
     SetupStageTRB setup{};
     setup.bits.request_type = setup_data.request_type.data;
@@ -77,8 +81,15 @@ namespace {
 }
 
 namespace usb::xhci {
+  // the contexts are zero cleared here because a pool slot may hold an old device.
   Device::Device(uint8_t slot_id, DoorbellRegister* dbreg)
-      : slot_id_{slot_id}, dbreg_{dbreg} {
+      : ctx_{}, input_ctx_{}, slot_id_{slot_id}, dbreg_{dbreg}, transfer_rings_{} {
+  }
+
+  Device::~Device() {
+    for (auto tr : transfer_rings_) {
+      ring_pool.Delete(tr);
+    }
   }
 
   Error Device::Initialize() {
@@ -96,7 +107,8 @@ namespace usb::xhci {
 
   Ring* Device::AllocTransferRing(DeviceContextIndex index, size_t buf_size) {
     int i = index.value - 1;
-    auto tr = AllocArray<Ring>(1, 64, 4096);
+    ring_pool.Delete(transfer_rings_[i]);
+    auto tr = ring_pool.New();
     if (tr) {
       tr->Initialize(buf_size);
     }
@@ -106,11 +118,16 @@ namespace usb::xhci {
 
   Error Device::ControlIn(EndpointID ep_id, SetupData setup_data,
                           void* buf, int len, ClassDriver* issuer) {
+    // the setup TRB must be registered after pushing the TRBs. fail before
+    // touching the ring so that no unregistered TRB is left for the next doorbell.
+    if (setup_stage_map_.Size() == setup_stage_map_.Capacity()) {
+      return MAKE_ERROR(Error::kFull);
+    }
     if (auto err = usb::Device::ControlIn(ep_id, setup_data, buf, len, issuer)) {
       return err;
     }
 
-    Log(kDebug, "Device::ControlIn: ep addr %d, buf 0x%08x, len %d\n",
+    LOG(kDebug, "Device::ControlIn: ep addr %d, buf 0x%08x, len %d\n",
         ep_id.Address(), buf, len);
     if (ep_id.Number() < 0 || 15 < ep_id.Number()) {
       return MAKE_ERROR(Error::kInvalidEndpointNumber);
@@ -135,7 +152,9 @@ namespace usb::xhci {
       auto data_trb_position = tr->Push(data);
       tr->Push(status);
 
-      setup_stage_map_.Put(data_trb_position, setup_trb_position);
+      if (auto err = setup_stage_map_.Put(data_trb_position, setup_trb_position)) {
+        return err;
+      }
     } else {
       auto setup_trb_position = TRBDynamicCast<SetupStageTRB>(tr->Push(
             MakeSetupStageTRB(setup_data, SetupStageTRB::kNoDataStage)));
@@ -143,7 +162,9 @@ namespace usb::xhci {
       status.bits.interrupt_on_completion = true;
       auto status_trb_position = tr->Push(status);
 
-      setup_stage_map_.Put(status_trb_position, setup_trb_position);
+      if (auto err = setup_stage_map_.Put(status_trb_position, setup_trb_position)) {
+        return err;
+      }
     }
 
     dbreg_->Ring(dci.value);
@@ -153,11 +174,15 @@ namespace usb::xhci {
 
   Error Device::ControlOut(EndpointID ep_id, SetupData setup_data,
                            const void* buf, int len, ClassDriver* issuer) {
+    // see ControlIn
+    if (setup_stage_map_.Size() == setup_stage_map_.Capacity()) {
+      return MAKE_ERROR(Error::kFull);
+    }
     if (auto err = usb::Device::ControlOut(ep_id, setup_data, buf, len, issuer)) {
       return err;
     }
 
-    Log(kDebug, "Device::ControlOut: ep addr %d, buf 0x%08x, len %d\n",
+    LOG(kDebug, "Device::ControlOut: ep addr %d, buf 0x%08x, len %d\n",
         ep_id.Address(), buf, len);
     if (ep_id.Number() < 0 || 15 < ep_id.Number()) {
       return MAKE_ERROR(Error::kInvalidEndpointNumber);
@@ -183,14 +208,18 @@ namespace usb::xhci {
       auto data_trb_position = tr->Push(data);
       tr->Push(status);
 
-      setup_stage_map_.Put(data_trb_position, setup_trb_position);
+      if (auto err = setup_stage_map_.Put(data_trb_position, setup_trb_position)) {
+        return err;
+      }
     } else {
       auto setup_trb_position = TRBDynamicCast<SetupStageTRB>(tr->Push(
             MakeSetupStageTRB(setup_data, SetupStageTRB::kNoDataStage)));
       status.bits.interrupt_on_completion = true;
       auto status_trb_position = tr->Push(status);
 
-      setup_stage_map_.Put(status_trb_position, setup_trb_position);
+      if (auto err = setup_stage_map_.Put(status_trb_position, setup_trb_position)) {
+        return err;
+      }
     }
 
     dbreg_->Ring(dci.value);
@@ -227,7 +256,7 @@ namespace usb::xhci {
       return err;
     }
 
-    Log(kDebug, "Device::InterrutpOut: ep addr %d, buf %08lx, len %d, dev %08lx\n",
+    LOG(kDebug, "Device::InterrutpOut: ep addr %d, buf %08lx, len %d, dev %08lx\n",
         ep_id.Address(), buf, len, this);
     return MAKE_ERROR(Error::kNotImplemented);
   }
@@ -237,10 +266,10 @@ namespace usb::xhci {
 
     if (trb.bits.completion_code != 1 /* Success */ &&
         trb.bits.completion_code != 13 /* Short Packet */) {
-      Log(kDebug, trb);
+      LOG(kDebug, trb);
       return MAKE_ERROR(Error::kTransferFailed);
     }
-    Log(kDebug, trb);
+    LOG(kDebug, trb);
 
     TRB* issuer_trb = trb.Pointer();
     if (auto normal_trb = TRBDynamicCast<NormalTRB>(issuer_trb)) {
@@ -252,10 +281,10 @@ namespace usb::xhci {
 
     auto opt_setup_stage_trb = setup_stage_map_.Get(issuer_trb);
     if (!opt_setup_stage_trb) {
-      Log(kDebug, "No Corresponding Setup Stage for issuer %s\n",
+      LOG(kDebug, "No Corresponding Setup Stage for issuer %s\n",
           kTRBTypeToName[issuer_trb->bits.trb_type]);
       if (auto data_trb = TRBDynamicCast<DataStageTRB>(issuer_trb)) {
-        Log(kDebug, *data_trb);
+        LOG(kDebug, *data_trb);
       }
       return MAKE_ERROR(Error::kNoCorrespondingSetupStage);
     }
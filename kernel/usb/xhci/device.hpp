@@ -34,6 +34,7 @@ namespace usb::xhci {
         TRB* issue_trb);
 
     Device(uint8_t slot_id, DoorbellRegister* dbreg);
+    ~Device() override;
 
     Error Initialize();
 
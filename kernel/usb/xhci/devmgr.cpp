@@ -1,6 +1,15 @@
 #include "usb/xhci/devmgr.hpp"
 
 #include "usb/memory.hpp"
+#include "usb/object_pool.hpp"
+
+namespace {
+  // one device for each slot. Controller enables kDeviceSize (8) slots.
+  // Device and input contexts must not cross a page boundary (xHCI Table 6-1),
+  // so each device gets a whole page.
+  static_assert(sizeof(usb::xhci::Device) <= 4096);
+  usb::ObjectPool<usb::xhci::Device, 8, 4096> device_pool;
+}
 
 namespace usb::xhci {
   Error DeviceManager::Initialize(size_t max_slots) {
@@ -76,8 +85,10 @@ namespace usb::xhci {
       return MAKE_ERROR(Error::kAlreadyAllocated);
     }
 
-    devices_[slot_id] = AllocArray<Device>(1, 64, 4096);
-    new(devices_[slot_id]) Device(slot_id, dbreg);
+    devices_[slot_id] = device_pool.New(slot_id, dbreg);
+    if (devices_[slot_id] == nullptr) {
+      return MAKE_ERROR(Error::kNoEnoughMemory);
+    }
     return MAKE_ERROR(Error::kSuccess);
   }
 
@@ -93,7 +104,7 @@ namespace usb::xhci {
 
   Error DeviceManager::Remove(uint8_t slot_id) {
     device_context_pointers_[slot_id] = nullptr;
-    FreeMem(devices_[slot_id]);
+    device_pool.Delete(devices_[slot_id]);
     devices_[slot_id] = nullptr;
     return MAKE_ERROR(Error::kSuccess);
   }
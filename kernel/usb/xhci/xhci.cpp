@@ -1,6 +1,7 @@
 #include "usb/xhci/xhci.hpp"
 
 #include "logger.hpp"
+#include "trace.hpp"
 #include "usb/setupdata.hpp"
 #include "usb/device.hpp"
 #include "usb/descriptor.hpp"
@@ -87,7 +88,8 @@ namespace {
 
   Error ResetPort(Controller& xhc, Port& port) {
     const bool is_connected = port.IsConnected();
-    Log(kDebug, "ResetPort: port.IsConnected() = %s\n",
+    trace::Record(trace::kUSB, trace::kXHCResetPort, port.Number(), is_connected);
+    LOG(kDebug, "ResetPort: port.IsConnected() = %s\n",
         is_connected ? "true" : "false");
 
     if (!is_connected) {
@@ -112,7 +114,9 @@ namespace {
   Error EnableSlot(Controller& xhc, Port& port) {
     const bool is_enabled = port.IsEnabled();
     const bool reset_completed = port.IsPortResetChanged();
-    Log(kDebug, "EnableSlot: port.IsEnabled() = %s, port.IsPortResetChanged() = %s\n",
+    trace::Record(trace::kUSB, trace::kXHCEnableSlot,
+                  port.Number(), is_enabled, reset_completed);
+    LOG(kDebug, "EnableSlot: port.IsEnabled() = %s, port.IsPortResetChanged() = %s\n",
         is_enabled ? "true" : "false",
         reset_completed ? "true" : "false");
 
@@ -129,9 +133,12 @@ namespace {
   }
 
   Error AddressDevice(Controller& xhc, uint8_t port_id, uint8_t slot_id) {
-    Log(kDebug, "AddressDevice: port_id = %d, slot_id = %d\n", port_id, slot_id);
+    trace::Record(trace::kUSB, trace::kXHCAddressDevice, port_id, slot_id);
+    LOG(kDebug, "AddressDevice: port_id = %d, slot_id = %d\n", port_id, slot_id);
 
-    xhc.DeviceManager()->AllocDevice(slot_id, xhc.DoorbellRegisterAt(slot_id));
+    if (auto err = xhc.DeviceManager()->AllocDevice(slot_id, xhc.DoorbellRegisterAt(slot_id))) {
+      return err;
+    }
 
     Device* dev = xhc.DeviceManager()->FindBySlot(slot_id);
     if (dev == nullptr) {
@@ -148,8 +155,12 @@ namespace {
     auto port = xhc.PortAt(port_id);
     InitializeSlotContext(*slot_ctx, port);
 
+    auto tr = dev->AllocTransferRing(ep0_dci, 32);
+    if (tr == nullptr) {
+      return MAKE_ERROR(Error::kNoEnoughMemory);
+    }
     InitializeEP0Context(
-        *ep0_ctx, dev->AllocTransferRing(ep0_dci, 32),
+        *ep0_ctx, tr,
         DetermineMaxPacketSizeForControlPipe(slot_ctx->bits.speed));
 
     xhc.DeviceManager()->LoadDCBAA(slot_id);
@@ -164,7 +175,8 @@ namespace {
   }
 
   Error InitializeDevice(Controller& xhc, uint8_t port_id, uint8_t slot_id) {
-    Log(kDebug, "InitializeDevice: port_id = %d, slot_id = %d\n", port_id, slot_id);
+    trace::Record(trace::kUSB, trace::kXHCInitializeDevice, port_id, slot_id);
+    LOG(kDebug, "InitializeDevice: port_id = %d, slot_id = %d\n", port_id, slot_id);
 
     auto dev = xhc.DeviceManager()->FindBySlot(slot_id);
     if (dev == nullptr) {
@@ -178,7 +190,8 @@ namespace {
   }
 
   Error CompleteConfiguration(Controller& xhc, uint8_t port_id, uint8_t slot_id) {
-    Log(kDebug, "CompleteConfiguration: port_id = %d, slot_id = %d\n", port_id, slot_id);
+    trace::Record(trace::kUSB, trace::kXHCCompleteConfiguration, port_id, slot_id);
+    LOG(kDebug, "CompleteConfiguration: port_id = %d, slot_id = %d\n", port_id, slot_id);
 
     auto dev = xhc.DeviceManager()->FindBySlot(slot_id);
     if (dev == nullptr) {
@@ -192,7 +205,9 @@ namespace {
   }
 
   Error OnEvent(Controller& xhc, PortStatusChangeEventTRB& trb) {
-    Log(kDebug, "PortStatusChangeEvent: port_id = %d\n", trb.bits.port_id);
+    trace::Record(trace::kUSB, trace::kXHCPortStatusChange,
+                  trb.bits.port_id, trb.bits.completion_code);
+    LOG(kDebug, "PortStatusChangeEvent: port_id = %d\n", trb.bits.port_id);
     auto port_id = trb.bits.port_id;
     auto port = xhc.PortAt(port_id);
 
@@ -208,6 +223,9 @@ namespace {
 
   Error OnEvent(Controller& xhc, TransferEventTRB& trb) {
     const uint8_t slot_id = trb.bits.slot_id;
+    trace::Record(trace::kUSB, trace::kXHCTransferEvent,
+                  slot_id, trb.bits.endpoint_id, trb.bits.completion_code,
+                  trb.bits.trb_transfer_length, trb.bits.trb_pointer);
     auto dev = xhc.DeviceManager()->FindBySlot(slot_id);
     if (dev == nullptr) {
       return MAKE_ERROR(Error::kInvalidSlotID);
@@ -227,7 +245,10 @@ namespace {
   Error OnEvent(Controller& xhc, CommandCompletionEventTRB& trb) {
     const auto issuer_type = trb.Pointer()->bits.trb_type;
     const auto slot_id = trb.bits.slot_id;
-    Log(kDebug, "CommandCompletionEvent: slot_id = %d, issuer = %s\n",
+    trace::Record(trace::kUSB, trace::kXHCCommandCompletion,
+                  slot_id, issuer_type, trb.bits.completion_code,
+                  reinterpret_cast<uintptr_t>(trb.Pointer()));
+    LOG(kDebug, "CommandCompletionEvent: slot_id = %d, issuer = %s\n",
         trb.bits.slot_id, kTRBTypeToName[issuer_type]);
 
     if (issuer_type == EnableSlotCommandTRB::Type) {
@@ -299,14 +320,14 @@ namespace {
     }
 
     r.bits.hc_os_owned_semaphore = 1;
-    Log(kDebug, "waiting until OS owns xHC...\n");
+    LOG(kDebug, "waiting until OS owns xHC...\n");
     reg.Write(r);
 
     do {
       r = reg.Read();
     } while (r.bits.hc_bios_owned_semaphore ||
              !r.bits.hc_os_owned_semaphore);
-    Log(kDebug, "OS has owned xHC\n");
+    LOG(kDebug, "OS has owned xHC\n");
   }
 }
 
@@ -347,7 +368,7 @@ namespace usb::xhci {
     while (op_->USBCMD.Read().bits.host_controller_reset);
     while (op_->USBSTS.Read().bits.controller_not_ready);
 
-    Log(kDebug, "MaxSlots: %u\n", cap_->HCSPARAMS1.Read().bits.max_device_slots);
+    LOG(kDebug, "MaxSlots: %u\n", cap_->HCSPARAMS1.Read().bits.max_device_slots);
     // Set "Max Slots Enabled" field in CONFIG.
     auto config = op_->CONFIG.Read();
     config.bits.max_device_slots_enabled = kDeviceSize;
@@ -361,11 +382,11 @@ namespace usb::xhci {
       auto scratchpad_buf_arr = AllocArray<void*>(max_scratchpad_buffers, 64, 4096);
       for (int i = 0; i < max_scratchpad_buffers; ++i) {
         scratchpad_buf_arr[i] = AllocMem(4096, 4096, 4096);
-        Log(kDebug, "scratchpad buffer array %d = %p\n",
+        LOG(kDebug, "scratchpad buffer array %d = %p\n",
             i, scratchpad_buf_arr[i]);
       }
       devmgr_.DeviceContexts()[0] = reinterpret_cast<DeviceContext*>(scratchpad_buf_arr);
-      Log(kInfo, "wrote scratchpad buffer array %p to dev ctx array 0\n",
+      LOG(kInfo, "wrote scratchpad buffer array %p to dev ctx array 0\n",
           scratchpad_buf_arr);
     }
 
@@ -468,6 +489,9 @@ namespace usb::xhci {
       ep_ctx->bits.average_trb_length = 1;
 
       auto tr = dev.AllocTransferRing(ep_dci, 32);
+      if (tr == nullptr) {
+        return MAKE_ERROR(Error::kNoEnoughMemory);
+      }
       ep_ctx->SetTransferRingBuffer(tr->Buffer());
 
       ep_ctx->bits.dequeue_cycle_state = 1;
@@ -501,6 +525,9 @@ namespace usb::xhci {
     }
     xhc.PrimaryEventRing()->Pop();
 
+    if (err) {
+      trace::Record(trace::kUSB, trace::kXHCEventError, err.Cause(), err.Line());
+    }
     return err;
   }
 }
@@ -0,0 +1,92 @@
+#!/usr/bin/python3
+
+import argparse
+import os
+import re
+import struct
+import sys
+
+
+MAGIC = b'MKTRACE\0'
+HEADER = struct.Struct('<8sHHIQQ')  # magic, version, category, capacity, head, reserved
+ENTRY = struct.Struct('<QHH5I')     # tsc, event, num_args, args[5]
+
+DEFAULT_HEADER = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                              '..', 'kernel', 'trace.hpp')
+ENUM_PATTERN = re.compile(r'enum\s+(\w+)\s*(?::\s*\w+\s*)?\{(.*?)\};', re.DOTALL)
+ENUMERATOR_PATTERN = re.compile(r'^\s*k(\w+)\s*(?:=\s*(\d+))?\s*,', re.MULTILINE)
+
+
+def load_enum(src: str, name: str) -> dict:
+    for m in ENUM_PATTERN.finditer(src):
+        if m.group(1) != name:
+            continue
+        result = {}
+        value = 0
+        for e in ENUMERATOR_PATTERN.finditer(m.group(2)):
+            if e.group(2) is not None:
+                value = int(e.group(2))
+            result[value] = e.group(1)
+            value += 1
+        return result
+    return {}
+
+
+def find_rings(dump: bytes):
+    pos = dump.find(MAGIC)
+    while pos >= 0:
+        if pos + HEADER.size <= len(dump):
+            _, version, category, capacity, head, _ = HEADER.unpack_from(dump, pos)
+            end = pos + HEADER.size + capacity * ENTRY.size
+            if version == 1 and 0 < capacity and end <= len(dump):
+                yield pos, category, capacity, head
+        pos = dump.find(MAGIC, pos + 1)
+
+
+def decode_ring(dump: bytes, pos: int, capacity: int, head: int, events: dict):
+    # the oldest entries have been overwritten if more than capacity were recorded
+    first = max(0, head - capacity)
+    base = pos + HEADER.size
+    for i in range(first, head):
+        tsc, event, num_args, *args = ENTRY.unpack_from(
+            dump, base + (i % capacity) * ENTRY.size)
+        name = events.get(event, 'Event{}'.format(event))
+        args_str = ', '.join('{:#x}'.format(a) for a in args[:min(num_args, 5)])
+        yield i, tsc, name, args_str
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='decode trace rings (kernel/trace.hpp) in a memory dump')
+    parser.add_argument('dump', help='path to a raw memory dump')
+    parser.add_argument('--header', default=DEFAULT_HEADER,
+                        help='path to trace.hpp which defines the event ids')
+    parser.add_argument('--category', help='show only this category (e.g. USB)')
+    ns = parser.parse_args()
+
+    with open(ns.header) as f:
+        src = f.read()
+    categories = load_enum(src, 'Category')
+    events = load_enum(src, 'Event')
+
+    with open(ns.dump, 'rb') as f:
+        dump = f.read()
+
+    found = False
+    for pos, category, capacity, head in find_rings(dump):
+        found = True
+        category_name = categories.get(category, str(category))
+        if ns.category and ns.category != category_name:
+            continue
+        print('# {} ring at offset {:#x}: {} entries recorded'.format(
+            category_name, pos, head))
+        for i, tsc, name, args_str in decode_ring(dump, pos, capacity, head, events):
+            print('{:8d} {:20d} {}({})'.format(i, tsc, name, args_str))
+
+    if not found:
+        print('no trace ring found in {}'.format(ns.dump), file=sys.stderr)
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()